@@ -1,55 +1,40 @@
 #include<iostream>
-#include<chrono>
-#include<numeric>
 #include<iomanip>
 #include<vector>
-#include<map>
+#include<string>
 #include<exception>
 #include<Eigen/Dense>
 
 #include <non_lin_optim/solvelin.h>
 #include <non_lin_optim/version.h>
 
-template<typename TimeT = std::chrono::milliseconds>
-struct measure {
-    template<typename F, typename ...Args>
-    static typename TimeT::rep run(F&& func, Args&&... args) {
-        auto start = std::chrono::steady_clock::now();
-        std::forward<decltype(func)>(func)(std::forward<Args>(args)...);
-        auto duration = std::chrono::duration_cast<TimeT>(std::chrono::steady_clock::now() - start);
-        return duration.count();
-    }
-};
-
-template<size_t N>
-struct mean_stddev {
-    template<typename F, typename ...Args>
-    static auto run(F&& func, Args&&... args){
-        std::array<double, N> buffer;
-        for(auto& buf:buffer)
-            buf = std::forward<decltype(func)>(func)(std::forward<Args>(args)...);
-        auto sum = std::accumulate(std::begin(buffer), std::end(buffer), 0.0);
-        auto mean = sum/buffer.size();
-        std::array<double, N> diff;
-        std::transform(std::begin(buffer), std::end(buffer), std::begin(diff), [mean](auto x) { return x - mean; });
-        auto sq_sum = std::inner_product(std::begin(diff), std::end(diff), std::begin(diff), 0.0);
-        auto stddev = std::sqrt(sq_sum/buffer.size());
-        return std::make_pair(mean,stddev);
-    }
-};
+#include "harness.h"
 
 using TA = Eigen::MatrixXd;
 using TB = Eigen::VectorXd;
 using TR = Eigen::VectorXd;
-using solve_fcn = std::function<TR(TA,TB)>;
-
-template<typename F>
-auto bench_solvelin(F&& func, int n){
-    TA A = TA::Random(n,n);
-    TB b = TB::Random(n);
-    A = A.transpose()*A; // make it positive matrix to avoid errors
-    return measure<>::run(func, A, b);
-}
+// arguments by reference so that no copy of A or b is timed
+using solve_fcn = TR(*)(const TA&, const TB&);
+
+enum Structure {
+    SPD,        // symmetric positive definite
+    General,    // square non-symmetric
+    Tall        // 4n x n least squares
+};
+
+struct Case {
+    std::string name;
+    Structure structure;
+    double condition;
+};
+
+struct Method {
+    std::string name;
+    solve_fcn func;
+    long max_size;      // slow decompositions are not run past this size
+    bool spd_only;
+    bool square_only;
+};
 
 struct Problem {
     TA A;
@@ -57,68 +42,121 @@ struct Problem {
     TR x;
 };
 
-int main(){
-    
+// A = Q diag(s) V^T with singular values log-spaced over the requested condition number, b = A x consistent
+Problem make_problem(const Case& c, const long n, const unsigned seed){
+    std::srand(seed);
+    const long m = c.structure==Tall ? 4*n : n;
+    Problem p;
+    const TB s = (std::log(c.condition)*TB::LinSpaced(n, -1, 0)).array().exp();
+    if(c.condition<=1){
+        p.A = TA::Random(m, n);
+        if(c.structure==SPD) p.A = p.A.transpose()*p.A + n*TA::Identity(n, n);
+    } else {
+        const TA Q = TA::Random(m, n).householderQr().householderQ()*TA::Identity(m, n);
+        const TA V = c.structure==SPD ? Q : TA(TA::Random(n, n).householderQr().householderQ());
+        p.A = Q*s.asDiagonal()*V.transpose();
+        if(c.structure==SPD) p.A = (p.A+p.A.transpose())/2;
+    }
+    p.x = TR::Random(n);
+    p.b = p.A*p.x;
+    return p;
+}
+
+int main(int argc, char** argv){
+
+    std::optional<harness::Options> parsed;
+    try {
+        parsed = harness::parse(argc, argv);
+    } catch (std::exception& e){
+        std::cerr << e.what() << std::endl;
+        harness::usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if(!parsed) return EXIT_SUCCESS;
+    const harness::Options& options = *parsed;
+
     std::cout << "Version:" << NON_LIN_OPTIM_VERSION << std::endl;
-    
-    const int times = 10;
-    
-    int sizes[] = {20, 50, 100};
-    
-    std::vector<std::pair<std::string, solve_fcn> > functions = {
-        {"solvelin::MoorePenrose", solvelin::MoorePenrose<TA,TB>},
-        {"solvelin::lu::fullPiv", solvelin::lu::fullPiv<TA,TB>},
-        {"solvelin::qr::householderQr", solvelin::qr::householderQr<TA,TB>},
-        {"solvelin::qr::colPivHouseholderQr", solvelin::qr::colPivHouseholderQr<TA,TB>},
-        {"solvelin::qr::fullPivHouseholderQr", solvelin::qr::fullPivHouseholderQr<TA,TB>},
-        {"solvelin::qr::completeOrthogonalDecomposition", solvelin::qr::completeOrthogonalDecomposition<TA,TB>},
-        {"solvelin::cholesky::llt", solvelin::cholesky::llt<TA,TB>},
-        {"solvelin::cholesky::ldlt", solvelin::cholesky::ldlt<TA,TB>},
-        {"solvelin::svd::bdc", solvelin::svd::bdc<TA,TB>},
-        {"solvelin::svd::jacobi", solvelin::svd::jacobi<TA,TB>}
+
+    const long sizes[] = {20, 50, 100, 200, 500, 1000, 2000, 4000};
+
+    const std::vector<Case> cases = {
+        {"spd", SPD, 1},
+        {"spd_ill", SPD, 1e10},
+        {"general", General, 1},
+        {"general_ill", General, 1e10},
+        {"tall", Tall, 1},
+        {"tall_ill", Tall, 1e8}
+    };
+
+    const std::vector<Method> methods = {
+        {"solvelin::MoorePenrose", [](const TA& A, const TB& b) -> TR { return solvelin::MoorePenrose(A, b); }, 4000, false, true},
+        {"solvelin::lu::fullPiv", [](const TA& A, const TB& b) -> TR { return solvelin::lu::fullPiv(A, b); }, 2000, false, true},
+        {"solvelin::qr::householderQr", [](const TA& A, const TB& b) -> TR { return solvelin::qr::householderQr(A, b); }, 4000, false, false},
+        {"solvelin::qr::colPivHouseholderQr", [](const TA& A, const TB& b) -> TR { return solvelin::qr::colPivHouseholderQr(A, b); }, 4000, false, false},
+        {"solvelin::qr::fullPivHouseholderQr", [](const TA& A, const TB& b) -> TR { return solvelin::qr::fullPivHouseholderQr(A, b); }, 1000, false, false},
+        {"solvelin::qr::completeOrthogonalDecomposition", [](const TA& A, const TB& b) -> TR { return solvelin::qr::completeOrthogonalDecomposition(A, b); }, 4000, false, false},
+        {"solvelin::cholesky::llt", [](const TA& A, const TB& b) -> TR { return solvelin::cholesky::llt(A, b, false); }, 4000, true, true},
+        {"solvelin::cholesky::ldlt", [](const TA& A, const TB& b) -> TR { return solvelin::cholesky::ldlt(A, b, false); }, 4000, true, true},
+        {"solvelin::svd::bdc", [](const TA& A, const TB& b) -> TR { return solvelin::svd::bdc(A, b); }, 1000, false, false},
+        {"solvelin::svd::jacobi", [](const TA& A, const TB& b) -> TR { return solvelin::svd::jacobi(A, b); }, 200, false, false},
+        {"solvelin::randomized::lstsq", [](const TA& A, const TB& b) -> TR { TR x; solvelin::randomized::lstsq(A, b, x); return x; }, 1000, false, false},
+        {"solvelin::LeastSquaresSolver", [](const TA& A, const TB& b) -> TR {
+            solvelin::LeastSquaresSolver<TA> solver;
+            solver.compute(A);
+            return solver.solve(b).x;
+        }, 4000, false, false}
     };
-    
-    std::cout << "=== Performance ===" << std::endl;
-    for(int n:sizes){
-        std::cout << "--- Matrix size (" << n << "," << n << ") ---" << std::endl;
-        
-        for(auto& [name,func]:functions){
-            auto [mean,std] = mean_stddev<times>::run([func,n](){return bench_solvelin<>(func, n);});
-            std::cout << name << ":" 
-                      << std::setw(55-name.length()) << mean << "(+-" << std::setprecision(6) 
-                      << std::setw(8) << std << ") [ms]" 
-                      << std::endl;       
+
+    std::vector<harness::Record> records;
+    for(const auto& c:cases){
+        for(long n:sizes){
+            if(n>options.max_size || (c.structure==Tall && 4*n>options.max_size)) continue;
+            std::cout << "--- " << c.name << " (" << (c.structure==Tall ? 4*n : n) << "," << n << ") ---" << std::endl;
+            const Problem p = make_problem(c, n, n);
+
+            for(const auto& method:methods){
+                if(n>method.max_size || (method.spd_only && c.structure!=SPD) || (method.square_only && c.structure==Tall))
+                    continue;
+                // the residual and error of the result are reported, failing decompositions included
+                TR x_hat;
+                std::string status = "ok";
+                harness::Timing timing;
+                try {
+                    timing = harness::measure([&](){
+                        x_hat = method.func(p.A, p.b);
+                        harness::keep(x_hat.size() ? x_hat(0) : 0);
+                    }, options);
+                } catch (std::exception& e){
+                    status = "failed";
+                }
+                const double residual = status=="ok" ? (p.A*x_hat-p.b).norm()/p.b.norm() : NAN;
+                const double error = status=="ok" ? (x_hat-p.x).norm()/p.x.norm() : NAN;
+
+                records.push_back(harness::Record()
+                    .set("case", c.name)
+                    .set("method", method.name)
+                    .set("rows", double(p.A.rows()))
+                    .set("cols", double(p.A.cols()))
+                    .set("condition", c.condition)
+                    .set("status", status)
+                    .set("time", timing)
+                    .set("residual", residual)
+                    .set("error", error));
+
+                std::cout << method.name << ":" << std::setw(55-method.name.length()) << " "
+                          << std::setw(14) << std::fixed << std::setprecision(0) << timing.median_ns << " ns"
+                          << " (+-" << std::setw(6) << std::setprecision(1) << (timing.median_ns>0 ? 100*timing.stddev_ns/timing.mean_ns : 0) << "%)"
+                          << std::scientific << std::setprecision(2)
+                          << "  residual " << residual << "  error " << error << " " << status
+                          << std::defaultfloat << std::endl;
+            }
         }
     }
-    
-    const int n = 50;
-    std::cout << "=== Accuracy (residual_error, error) ===" << std::endl;
-    for(int m:sizes){
-        std::cout << "--- Matrix size (" << n << "," << m << ") ---" << std::endl;    
-        
-        TA A = TA::Random(n,m);
-        TB b = TB::Random(n);
-        if(n==m) 
-            A = A.transpose()*A; // make it positive matrix to avoid errors
-        TR x = solvelin::svd::bdc<TA,TB>(A, b);
-        
-        for(auto& [name,func]:functions){
-            
-            try {
-                TR x_hat = func(A,b);
-                
-                double residual_error = (A*x_hat - b).norm();
-                double error = (x-x_hat).norm();
-
-                std::cout << name << ":" 
-                          << std::setw(60-name.length()) << residual_error << std::setprecision(6)
-                          << std::setw(15) << error << std::setprecision(6)
-                          << std::endl;                 
-            } catch (std::exception& e){
-                std::cout << name << " " << e.what() << std::endl;
-            }
-        }    
+
+    try {
+        return harness::finish(records, options, NON_LIN_OPTIM_VERSION, {"case", "method", "rows", "cols"}, "time_median_ns");
+    } catch (std::exception& e){
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
     }
-    
-    return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,311 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <numeric>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace harness {
+
+    struct Options {
+        int warmup = 1;
+        int min_repeats = 3;
+        int max_repeats = 50;
+        double min_time = 0.2;      // seconds spent timing each case once warmed up, within the repeat bounds
+        long max_size = 4000;
+        std::string json;
+        std::string csv;
+        std::string baseline;
+        double threshold = 0.25;    // accepted slowdown relative to the baseline
+        double slack_ns = 2000;     // absolute slack, timer and scheduling noise dominate shorter runs
+    };
+
+    inline
+    void usage(const char* name){
+        std::cout << "Usage: " << name << " [options]\n"
+                  << "  --warmup N         untimed runs before timing (default 1)\n"
+                  << "  --repeats MIN,MAX  bounds on timed runs (default 3,50)\n"
+                  << "  --min-time S       seconds spent timing each case (default 0.2)\n"
+                  << "  --max-size N       largest problem size (default 4000)\n"
+                  << "  --quick            same as --max-size 200 --min-time 0.05\n"
+                  << "  --json PATH        write the results as JSON\n"
+                  << "  --csv PATH         write the results as CSV\n"
+                  << "  --baseline PATH    CSV of a previous run, exit with 1 when a case got slower\n"
+                  << "  --threshold F      accepted relative slowdown (default 0.25)\n"
+                  << "  --slack-ns N       accepted absolute slowdown (default 2000)\n";
+    }
+
+    // Returns nothing when --help was asked
+    inline
+    std::optional<Options> parse(int argc, char** argv){
+        Options options;
+        auto value = [&](int& i) -> std::string {
+            if(i+1>=argc)
+                throw std::invalid_argument(std::string("Missing value for ") + argv[i]);
+            return argv[++i];
+        };
+        for(int i=1; i<argc; ++i){
+            const std::string arg = argv[i];
+            if(arg=="--help" || arg=="-h"){
+                usage(argv[0]);
+                return std::nullopt;
+            }
+            else if(arg=="--warmup") options.warmup = std::stoi(value(i));
+            else if(arg=="--repeats"){
+                const std::string v = value(i);
+                const auto comma = v.find(',');
+                options.min_repeats = std::stoi(v.substr(0, comma));
+                options.max_repeats = comma==std::string::npos ? options.min_repeats : std::stoi(v.substr(comma+1));
+            }
+            else if(arg=="--min-time") options.min_time = std::stod(value(i));
+            else if(arg=="--max-size") options.max_size = std::stol(value(i));
+            else if(arg=="--quick"){
+                options.max_size = 200;
+                options.min_time = 0.05;
+            }
+            else if(arg=="--json") options.json = value(i);
+            else if(arg=="--csv") options.csv = value(i);
+            else if(arg=="--baseline") options.baseline = value(i);
+            else if(arg=="--threshold") options.threshold = std::stod(value(i));
+            else if(arg=="--slack-ns") options.slack_ns = std::stod(value(i));
+            else throw std::invalid_argument("Unknown option " + arg);
+        }
+        if(options.min_repeats<1 || options.max_repeats<options.min_repeats)
+            throw std::invalid_argument("Invalid --repeats!");
+        return options;
+    }
+
+    inline volatile double sink = 0;
+
+    // Keeps the compiler from discarding a computation whose result is otherwise unused
+    inline
+    void keep(const double value){
+        sink = value;
+    }
+
+    // Timings of a case, NaN when the case failed so that it is recorded as missing rather than as 0 ns
+    struct Timing {
+        double median_ns = NAN;
+        double mean_ns = NAN;
+        double stddev_ns = NAN;
+        double min_ns = NAN;
+        int repeats = 0;
+    };
+
+    // Runs func options.warmup times untimed, then times it until min_time has elapsed within the repeat bounds
+    template<typename F>
+    Timing measure(F&& func, const Options& options){
+        using clock = std::chrono::steady_clock;
+        for(int i=0; i<options.warmup; ++i)
+            func();
+
+        std::vector<double> samples;
+        double total = 0;
+        while(static_cast<int>(samples.size())<options.max_repeats &&
+              (static_cast<int>(samples.size())<options.min_repeats || total<options.min_time*1e9)){
+            const auto start = clock::now();
+            func();
+            const double ns = std::chrono::duration<double, std::nano>(clock::now()-start).count();
+            samples.push_back(ns);
+            total += ns;
+        }
+
+        Timing timing;
+        timing.repeats = samples.size();
+        timing.mean_ns = total/samples.size();
+        double sq_sum = 0;
+        for(double s:samples)
+            sq_sum += (s-timing.mean_ns)*(s-timing.mean_ns);
+        timing.stddev_ns = std::sqrt(sq_sum/samples.size());
+        std::sort(samples.begin(), samples.end());
+        timing.min_ns = samples.front();
+        const size_t mid = samples.size()/2;
+        timing.median_ns = samples.size()%2 ? samples[mid] : (samples[mid-1]+samples[mid])/2;
+        return timing;
+    }
+
+    enum class Kind {
+        Text,
+        Number,
+        Missing // a NaN value, "nan" in CSV and null in JSON
+    };
+
+    // One result row, fields are kept in insertion order for the CSV columns
+    class Record {
+    private:
+        std::vector<std::pair<std::string, std::string>> fields;
+        std::vector<Kind> kinds;
+
+    public:
+        Record& set(const std::string& key, const std::string& value){
+            fields.emplace_back(key, value);
+            kinds.push_back(Kind::Text);
+            return *this;
+        }
+
+        Record& set(const std::string& key, const double value){
+            std::ostringstream s;
+            s.precision(std::isfinite(value) ? 10 : 1);
+            s << value;
+            fields.emplace_back(key, s.str());
+            kinds.push_back(std::isnan(value) ? Kind::Missing : std::isfinite(value) ? Kind::Number : Kind::Text);
+            return *this;
+        }
+
+        Record& set(const std::string& key, const Timing& timing){
+            return set(key+"_median_ns", timing.median_ns)
+                  .set(key+"_mean_ns", timing.mean_ns)
+                  .set(key+"_stddev_ns", timing.stddev_ns)
+                  .set(key+"_min_ns", timing.min_ns)
+                  .set("repeats", double(timing.repeats));
+        }
+
+        std::string get(const std::string& key) const {
+            for(const auto& [k, v]:fields)
+                if(k==key) return v;
+            return "";
+        }
+
+        const std::vector<std::pair<std::string, std::string>>& items() const {
+            return fields;
+        }
+
+        Kind kind(const size_t i) const {
+            return kinds[i];
+        }
+    };
+
+    inline
+    void write_csv(const std::string& path, const std::vector<Record>& records){
+        std::ofstream out(path, std::ios::trunc);
+        if(!out)
+            throw std::runtime_error("Cannot open " + path + " for writing!");
+        if(records.empty()) return;
+        for(size_t i=0; i<records[0].items().size(); ++i)
+            out << (i ? "," : "") << records[0].items()[i].first;
+        out << "\n";
+        for(const auto& record:records){
+            for(size_t i=0; i<record.items().size(); ++i)
+                out << (i ? "," : "") << record.items()[i].second;
+            out << "\n";
+        }
+    }
+
+    inline
+    void write_json(const std::string& path, const std::string& version, const std::vector<Record>& records){
+        std::ofstream out(path, std::ios::trunc);
+        if(!out)
+            throw std::runtime_error("Cannot open " + path + " for writing!");
+        out << "{\n  \"version\": \"" << version << "\",\n  \"results\": [\n";
+        for(size_t r=0; r<records.size(); ++r){
+            out << "    {";
+            const auto& items = records[r].items();
+            for(size_t i=0; i<items.size(); ++i){
+                out << (i ? ", " : "") << "\"" << items[i].first << "\": ";
+                switch(records[r].kind(i)){
+                    case Kind::Number: out << items[i].second; break;
+                    case Kind::Missing: out << "null"; break;
+                    case Kind::Text: out << "\"" << items[i].second << "\""; break;
+                }
+            }
+            out << "}" << (r+1<records.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n}\n";
+    }
+
+    inline
+    std::vector<std::map<std::string, std::string>> read_csv(const std::string& path){
+        std::ifstream in(path);
+        if(!in)
+            throw std::runtime_error("Cannot open " + path + "!");
+        auto split = [](const std::string& line){
+            std::vector<std::string> cells;
+            std::stringstream s(line);
+            std::string cell;
+            while(std::getline(s, cell, ','))
+                cells.push_back(cell);
+            return cells;
+        };
+        std::string line;
+        std::getline(in, line);
+        const auto header = split(line);
+        std::vector<std::map<std::string, std::string>> rows;
+        while(std::getline(in, line)){
+            if(line.empty()) continue;
+            const auto cells = split(line);
+            if(cells.size()!=header.size())
+                throw std::runtime_error(path + " has a malformed row!");
+            auto& row = rows.emplace_back();
+            for(size_t i=0; i<header.size(); ++i)
+                row[header[i]] = cells[i];
+        }
+        return rows;
+    }
+
+    // Compares the metric of every record to the baseline row with the same key fields. Returns the number of
+    // records slower than baseline*(1+threshold)+slack, cases missing from the baseline are reported but pass.
+    // Cases without a measurement, because they failed now or in the baseline, are reported and not compared.
+    inline
+    int compare(const std::vector<Record>& records, const Options& options, const std::vector<std::string>& keys,
+                const std::string& metric){
+        const auto baseline = read_csv(options.baseline);
+        auto key_of = [&](auto&& get){
+            std::string key;
+            for(const auto& k:keys) key += get(k) + " ";
+            return key;
+        };
+        std::map<std::string, double> reference;
+        for(const auto& row:baseline){
+            const auto it = row.find(metric);
+            if(it!=row.end())
+                reference[key_of([&](const std::string& k){ auto f = row.find(k); return f!=row.end() ? f->second : ""; })] = std::stod(it->second);
+        }
+
+        int regressions = 0;
+        for(const auto& record:records){
+            const std::string key = key_of([&](const std::string& k){ return record.get(k); });
+            const auto it = reference.find(key);
+            if(it==reference.end()){
+                std::cout << "NEW        " << key << std::endl;
+                continue;
+            }
+            const double value = std::stod(record.get(metric));
+            if(!std::isfinite(value) || !std::isfinite(it->second)){
+                std::cout << "UNMEASURED " << key << (std::isfinite(value) ? "(failed in the baseline)" : "(failed)") << std::endl;
+                continue;
+            }
+            const double ratio = value/std::max(it->second, 1.0);
+            if(value > it->second*(1+options.threshold)+options.slack_ns){
+                ++regressions;
+                std::cout << "REGRESSION " << key << std::fixed << std::setprecision(2) << ratio << "x ("
+                          << std::setprecision(0) << it->second << " -> " << value << " ns)" << std::defaultfloat << std::endl;
+            }
+        }
+        std::cout << regressions << " regression(s) against " << options.baseline << std::endl;
+        return regressions;
+    }
+
+    // Writes the requested outputs and compares to the baseline, returns the process exit code
+    inline
+    int finish(const std::vector<Record>& records, const Options& options, const std::string& version,
+               const std::vector<std::string>& keys, const std::string& metric){
+        if(!options.csv.empty()) write_csv(options.csv, records);
+        if(!options.json.empty()) write_json(options.json, version, records);
+        if(!options.baseline.empty() && compare(records, options, keys, metric)>0)
+            return EXIT_FAILURE;
+        return EXIT_SUCCESS;
+    }
+
+} // end namespace harness
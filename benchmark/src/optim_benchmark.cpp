@@ -0,0 +1,367 @@
+#include<iostream>
+#include<iomanip>
+#include<vector>
+#include<string>
+#include<exception>
+#include<functional>
+#include<random>
+#include<numbers>
+#include<Eigen/Dense>
+
+#include <non_lin_optim/optim.h>
+#include <non_lin_optim/version.h>
+
+#include "harness.h"
+
+using namespace non_lin_optim;
+
+struct TestProblem {
+    std::string name;
+    std::string suite;
+    Func_v residuals;
+    Vector x0;
+    double f_star;      // certified or best known minimum of ||r||^2
+};
+
+Vector vec(std::initializer_list<double> values){
+    Vector v(values.size());
+    std::copy(values.begin(), values.end(), v.data());
+    return v;
+}
+
+// Moré, Garbow, Hillstrom, "Testing unconstrained optimization software", ACM TOMS 7(1), 1981, standard starting points
+std::vector<TestProblem> mgh_problems(){
+    std::vector<TestProblem> problems;
+
+    problems.push_back({"rosenbrock", "MGH", [](const Vector& x) -> Vector {
+        return vec({10*(x(1)-x(0)*x(0)), 1-x(0)});
+    }, vec({-1.2, 1}), 0});
+
+    problems.push_back({"freudenstein_roth", "MGH", [](const Vector& x) -> Vector {
+        return vec({-13+x(0)+((5-x(1))*x(1)-2)*x(1), -29+x(0)+((x(1)+1)*x(1)-14)*x(1)});
+    }, vec({0.5, -2}), 48.9842536});
+
+    problems.push_back({"powell_badly_scaled", "MGH", [](const Vector& x) -> Vector {
+        return vec({1e4*x(0)*x(1)-1, std::exp(-x(0))+std::exp(-x(1))-1.0001});
+    }, vec({0, 1}), 0});
+
+    problems.push_back({"brown_badly_scaled", "MGH", [](const Vector& x) -> Vector {
+        return vec({x(0)-1e6, x(1)-2e-6, x(0)*x(1)-2});
+    }, vec({1, 1}), 0});
+
+    problems.push_back({"beale", "MGH", [](const Vector& x) -> Vector {
+        return vec({1.5-x(0)*(1-x(1)), 2.25-x(0)*(1-x(1)*x(1)), 2.625-x(0)*(1-x(1)*x(1)*x(1))});
+    }, vec({1, 1}), 0});
+
+    problems.push_back({"jennrich_sampson", "MGH", [](const Vector& x) -> Vector {
+        Vector r(10);
+        for(int i=1; i<=10; ++i)
+            r(i-1) = 2+2*i-(std::exp(i*x(0))+std::exp(i*x(1)));
+        return r;
+    }, vec({0.3, 0.4}), 124.362182});
+
+    problems.push_back({"helical_valley", "MGH", [](const Vector& x) -> Vector {
+        double theta = std::atan(x(1)/x(0))/(2*std::numbers::pi);
+        if(x(0)<0) theta += 0.5;
+        return vec({10*(x(2)-10*theta), 10*(std::sqrt(x(0)*x(0)+x(1)*x(1))-1), x(2)});
+    }, vec({-1, 0, 0}), 0});
+
+    problems.push_back({"bard", "MGH", [](const Vector& x) -> Vector {
+        const double y[] = {0.14, 0.18, 0.22, 0.25, 0.29, 0.32, 0.35, 0.39, 0.37, 0.58, 0.73, 0.96, 1.34, 2.10, 4.39};
+        Vector r(15);
+        for(int i=1; i<=15; ++i){
+            const double u = i, v = 16-i, w = std::min(u, v);
+            r(i-1) = y[i-1]-(x(0)+u/(x(1)*v+x(2)*w));
+        }
+        return r;
+    }, vec({1, 1, 1}), 8.21487730e-3});
+
+    problems.push_back({"gaussian", "MGH", [](const Vector& x) -> Vector {
+        const double y[] = {0.0009, 0.0044, 0.0175, 0.0540, 0.1295, 0.2420, 0.3521, 0.3989, 0.3521, 0.2420, 0.1295, 0.0540, 0.0175, 0.0044, 0.0009};
+        Vector r(15);
+        for(int i=1; i<=15; ++i){
+            const double t = (8-i)/2.0;
+            r(i-1) = x(0)*std::exp(-x(1)*(t-x(2))*(t-x(2))/2)-y[i-1];
+        }
+        return r;
+    }, vec({0.4, 1, 0}), 1.12793277e-8});
+
+    problems.push_back({"box_3d", "MGH", [](const Vector& x) -> Vector {
+        Vector r(10);
+        for(int i=1; i<=10; ++i){
+            const double t = 0.1*i;
+            r(i-1) = std::exp(-t*x(0))-std::exp(-t*x(1))-x(2)*(std::exp(-t)-std::exp(-10*t));
+        }
+        return r;
+    }, vec({0, 10, 20}), 0});
+
+    problems.push_back({"powell_singular", "MGH", [](const Vector& x) -> Vector {
+        return vec({x(0)+10*x(1), std::sqrt(5.0)*(x(2)-x(3)), std::pow(x(1)-2*x(2), 2), std::sqrt(10.0)*std::pow(x(0)-x(3), 2)});
+    }, vec({3, -1, 0, 1}), 0});
+
+    problems.push_back({"wood", "MGH", [](const Vector& x) -> Vector {
+        return vec({10*(x(1)-x(0)*x(0)), 1-x(0), std::sqrt(90.0)*(x(3)-x(2)*x(2)), 1-x(2),
+                    std::sqrt(10.0)*(x(1)+x(3)-2), (x(1)-x(3))/std::sqrt(10.0)});
+    }, vec({-3, -1, -3, -1}), 0});
+
+    problems.push_back({"brown_dennis", "MGH", [](const Vector& x) -> Vector {
+        Vector r(20);
+        for(int i=1; i<=20; ++i){
+            const double t = i/5.0;
+            r(i-1) = std::pow(x(0)+t*x(1)-std::exp(t), 2) + std::pow(x(2)+x(3)*std::sin(t)-std::cos(t), 2);
+        }
+        return r;
+    }, vec({25, 5, -5, -1}), 85822.2016});
+
+    problems.push_back({"osborne_1", "MGH", [](const Vector& x) -> Vector {
+        const double y[] = {0.844, 0.908, 0.932, 0.936, 0.925, 0.908, 0.881, 0.850, 0.818, 0.784, 0.751, 0.718, 0.685, 0.658,
+                            0.628, 0.603, 0.580, 0.558, 0.538, 0.522, 0.506, 0.490, 0.478, 0.467, 0.457, 0.448, 0.438, 0.431,
+                            0.424, 0.420, 0.414, 0.411, 0.406};
+        Vector r(33);
+        for(int i=0; i<33; ++i){
+            const double t = 10.0*i;
+            r(i) = y[i]-(x(0)+x(1)*std::exp(-t*x(3))+x(2)*std::exp(-t*x(4)));
+        }
+        return r;
+    }, vec({0.5, 1.5, -1, 0.01, 0.02}), 5.46489469e-5});
+
+    problems.push_back({"biggs_exp6", "MGH", [](const Vector& x) -> Vector {
+        Vector r(13);
+        for(int i=1; i<=13; ++i){
+            const double t = 0.1*i;
+            const double y = std::exp(-t)-5*std::exp(-10*t)+3*std::exp(-4*t);
+            r(i-1) = x(2)*std::exp(-t*x(0))-x(3)*std::exp(-t*x(1))+x(5)*std::exp(-t*x(4))-y;
+        }
+        return r;
+    }, vec({1, 2, 1, 1, 1, 1}), 0});
+
+    problems.push_back({"extended_rosenbrock_100", "MGH", [](const Vector& x) -> Vector {
+        Vector r(x.size());
+        for(int i=0; i<x.size(); i+=2){
+            r(i) = 10*(x(i+1)-x(i)*x(i));
+            r(i+1) = 1-x(i);
+        }
+        return r;
+    }, Vector::NullaryExpr(100, [](Eigen::Index i){ return i%2 ? 1.0 : -1.2; }), 0});
+
+    return problems;
+}
+
+// NIST StRD nonlinear regression datasets, first starting values, f_star is the certified residual sum of squares
+std::vector<TestProblem> nist_problems(){
+    std::vector<TestProblem> problems;
+
+    auto regression = [](const std::vector<std::pair<double, double>>& data, auto model){
+        return [data, model](const Vector& b) -> Vector {
+            Vector r(data.size());
+            for(size_t i=0; i<data.size(); ++i)
+                r(i) = data[i].first-model(data[i].second, b);
+            return r;
+        };
+    };
+
+    problems.push_back({"misra1a", "NIST", regression(
+        {{10.07, 77.6}, {14.73, 114.9}, {17.94, 141.1}, {23.93, 190.8}, {29.61, 239.9}, {35.18, 289.0}, {40.02, 332.8},
+         {44.82, 378.4}, {50.76, 434.8}, {55.05, 477.3}, {61.01, 536.8}, {66.40, 593.1}, {75.47, 689.1}, {81.78, 760.0}},
+        [](double x, const Vector& b){ return b(0)*(1-std::exp(-b(1)*x)); }),
+        vec({500, 1e-4}), 1.2455138894e-01});
+
+    problems.push_back({"danwood", "NIST", regression(
+        {{2.138, 1.309}, {3.421, 1.471}, {3.597, 1.490}, {4.340, 1.565}, {4.882, 1.611}, {5.660, 1.680}},
+        [](double x, const Vector& b){ return b(0)*std::pow(x, b(1)); }),
+        vec({1, 5}), 4.3173084083e-03});
+
+    problems.push_back({"boxbod", "NIST", regression(
+        {{109, 1}, {149, 2}, {149, 3}, {191, 5}, {213, 7}, {224, 10}},
+        [](double x, const Vector& b){ return b(0)*(1-std::exp(-b(1)*x)); }),
+        vec({1, 1}), 1.1680088766e+03});
+
+    problems.push_back({"rat42", "NIST", regression(
+        {{8.930, 9}, {10.800, 14}, {18.590, 21}, {22.330, 28}, {39.350, 42}, {56.110, 57}, {61.730, 63}, {64.620, 70}, {67.080, 79}},
+        [](double x, const Vector& b){ return b(0)/(1+std::exp(b(1)-b(2)*x)); }),
+        vec({100, 1, 0.1}), 8.0565229338e+00});
+
+    problems.push_back({"rat43", "NIST", regression(
+        {{16.08, 1}, {33.83, 2}, {65.80, 3}, {97.20, 4}, {191.55, 5}, {326.20, 6}, {386.87, 7}, {520.53, 8},
+         {590.03, 9}, {651.92, 10}, {724.93, 11}, {699.56, 12}, {689.96, 13}, {637.56, 14}, {717.41, 15}},
+        [](double x, const Vector& b){ return b(0)/std::pow(1+std::exp(b(1)-b(2)*x), 1/b(3)); }),
+        vec({100, 10, 1, 1}), 8.7864049080e+03});
+
+    problems.push_back({"mgh09", "NIST", regression(
+        {{0.1957, 4}, {0.1947, 2}, {0.1735, 1}, {0.1600, 0.5}, {0.0844, 0.25}, {0.0627, 0.167}, {0.0456, 0.125},
+         {0.0342, 0.1}, {0.0323, 0.0833}, {0.0235, 0.0714}, {0.0246, 0.0625}},
+        [](double x, const Vector& b){ return b(0)*(x*x+x*b(1))/(x*x+x*b(2)+b(3)); }),
+        vec({25, 39, 41.5, 39}), 3.0750560385e-04});
+
+    problems.push_back({"mgh10", "NIST", regression(
+        {{34780, 50}, {28610, 55}, {23650, 60}, {19630, 65}, {16370, 70}, {13720, 75}, {11540, 80}, {9744, 85},
+         {8261, 90}, {7030, 95}, {6005, 100}, {5147, 105}, {4427, 110}, {3820, 115}, {3307, 120}, {2872, 125}},
+        [](double x, const Vector& b){ return b(0)*std::exp(b(1)/(x+b(2))); }),
+        vec({2, 400000, 25000}), 8.7945855171e+01});
+
+    return problems;
+}
+
+// The refine_camera_extrinsics example with n synthetic points seen without noise from the ground truth pose
+TestProblem camera_problem(const int n){
+    Eigen::Matrix<Scalar,3,3> K {
+        {866.4245,   0.     , 736.4805 },
+        {0.      , 875.8444 , 174.83566},
+        {0.      ,   0.     ,   1.     }
+    };
+    Vector x_gt(6);
+    x_gt << 2.3066754, 4.6928096, 10.964986, 1.3037287, -1.6955427, 1.3341713;
+
+    auto project = [K](const Vector& x, const Matrix& points){
+        const Vector rvec = x.segment<3>(3);
+        const Scalar theta = rvec.norm();
+        const Eigen::Matrix<Scalar,3,3> R = theta>0 ? Eigen::AngleAxis<Scalar>(theta, rvec/theta).toRotationMatrix()
+                                                    : Eigen::Matrix<Scalar,3,3>::Identity();
+        const Matrix xyw = K*((R*points).colwise() + x.head<3>());
+        return Matrix(xyw.topRows(2).array().rowwise()/xyw.row(2).array());
+    };
+
+    std::mt19937 rng(n);
+    std::uniform_real_distribution<Scalar> uniform(-1, 1);
+    Matrix points(3, n);
+    for(int i=0; i<n; ++i)
+        points.col(i) << 5*uniform(rng), 10*uniform(rng), 1+uniform(rng);
+    const Matrix uv = project(x_gt, points);
+
+    Vector x0(6);
+    x0 << 2.2066754, 4.8928096, 10.064986, 1.2037287, -1.555427, 1.6341713;
+    return {"camera_extrinsics_" + std::to_string(n), "camera", [project, points, uv](const Vector& x) -> Vector {
+        const Matrix r = project(x, points)-uv;
+        return Eigen::Map<const Vector>(r.data(), r.size());
+    }, x0, 0};
+}
+
+struct Optimizer {
+    std::string name;
+    int max_iter;
+    int max_residuals;  // slow first order methods are not run on larger problems
+    std::function<ResultInfo(const Func_v&, Vector&, const Progress&, RunStats&)> run;
+};
+
+template<typename O>
+ResultInfo run(O&& optimizer, Vector& x, const Progress& progress, RunStats& stats){
+    ResultInfo info = optimizer.run(x, std::stop_token(), Clock::time_point::max(), progress);
+    stats = optimizer.statistics();
+    return info;
+}
+
+int main(int argc, char** argv){
+
+    std::optional<harness::Options> parsed;
+    try {
+        parsed = harness::parse(argc, argv);
+    } catch (std::exception& e){
+        std::cerr << e.what() << std::endl;
+        harness::usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if(!parsed) return EXIT_SUCCESS;
+    const harness::Options& options = *parsed;
+
+    std::cout << "Version:" << NON_LIN_OPTIM_VERSION << std::endl;
+
+    const Scalar tol = 1e-16;
+    const Scalar step = 1e-3;
+    const std::vector<Optimizer> optimizers = {
+        {"GaussianNewton", 2000, 1<<30, [=](const Func_v& f, Vector& x, const Progress& p, RunStats& s){
+            return run(optim::GaussianNewton(f, 2000, tol), x, p, s); }},
+        {"GaussianNewton+selection", 2000, 1<<30, [=](const Func_v& f, Vector& x, const Progress& p, RunStats& s){
+            optim::GaussianNewton gn(f, 2000, tol);
+            gn.set_solver_selection(true);
+            return run(gn, x, p, s); }},
+        {"Dogleg", 2000, 1<<30, [=](const Func_v& f, Vector& x, const Progress& p, RunStats& s){
+            return run(optim::Dogleg(f, 2000, tol), x, p, s); }},
+        {"Newton", 2000, 20000, [=](const Func_v& f, Vector& x, const Progress& p, RunStats& s){
+            Func_s f_s = [&f](const Vector& x){ return f(x).squaredNorm(); };
+            return run(optim::Newton(f_s, 2000, tol), x, p, s); }},
+        {"ConjugateGradient", 2000, 20000, [=](const Func_v& f, Vector& x, const Progress& p, RunStats& s){
+            return run(optim::ConjugateGradient(f, 2000, tol), x, p, s); }},
+        {"NesterovGradient", 2000, 20000, [=](const Func_v& f, Vector& x, const Progress& p, RunStats& s){
+            return run(optim::NesterovGradient(f, 2000, tol, step), x, p, s); }},
+        {"GradientDescent", 2000, 20000, [=](const Func_v& f, Vector& x, const Progress& p, RunStats& s){
+            return run(optim::GradientDescent(f, 2000, tol, step), x, p, s); }}
+    };
+
+    std::vector<TestProblem> problems = mgh_problems();
+    for(auto& p:nist_problems())
+        problems.push_back(std::move(p));
+    for(int n:{100, 1000, 10000, 100000})
+        if(n<=25*options.max_size) problems.push_back(camera_problem(n));
+
+    std::vector<harness::Record> records;
+    for(const auto& problem:problems){
+        const long m = problem.residuals(problem.x0).size();
+        std::cout << "--- " << problem.suite << " " << problem.name << " (" << m << "," << problem.x0.size() << ") ---" << std::endl;
+
+        for(const auto& optimizer:optimizers){
+            if(m>optimizer.max_residuals) continue;
+
+            long evaluations = 0;
+            const Func_v counted = [&](const Vector& x){
+                ++evaluations;
+                return problem.residuals(x);
+            };
+
+            Vector x;
+            RunStats stats;
+            std::string status;
+            harness::Timing timing;
+            try {
+                timing = harness::measure([&](){
+                    x = problem.x0;
+                    evaluations = 0;
+                    ResultInfo info = optimizer.run(counted, x, nullptr, stats);
+                    std::ostringstream s;
+                    s << info;
+                    status = s.str();
+                    harness::keep(x(0));
+                }, options);
+            } catch (std::exception& e){
+                status = "Exception";
+            }
+
+            const double error = status!="Exception" ? problem.residuals(x).squaredNorm() : NAN;
+            // relative to the certified minimum, or absolute for zero residual problems
+            const bool solved = std::isfinite(error) && error <= problem.f_star*(1+1e-6) + 1e-10;
+
+            records.push_back(harness::Record()
+                .set("suite", problem.suite)
+                .set("problem", problem.name)
+                .set("optimizer", optimizer.name)
+                .set("residuals", double(m))
+                .set("parameters", double(problem.x0.size()))
+                .set("status", status)
+                .set("solved", solved ? "yes" : "no")
+                .set("time", timing)
+                .set("iterations", double(stats.iterations))
+                .set("function_calls", double(evaluations))
+                .set("residual_evaluations", double(stats.residual_evaluations))
+                .set("jacobian_evaluations", double(stats.jacobian_evaluations))
+                .set("fallbacks", double(stats.fallbacks))
+                .set("gradient_norm", double(stats.gradient_norm))
+                .set("final_error", error)
+                .set("f_star", problem.f_star));
+
+            std::cout << optimizer.name << ":" << std::setw(30-optimizer.name.length()) << " "
+                      << std::setw(14) << std::fixed << std::setprecision(0) << timing.median_ns << " ns"
+                      << std::setw(6) << stats.iterations << " it"
+                      << std::setw(9) << evaluations << " f"
+                      << std::setw(6) << stats.jacobian_evaluations << " J"
+                      << std::scientific << std::setprecision(4) << "  error " << error
+                      << "  " << (solved ? "solved " : "failed ") << status
+                      << std::defaultfloat << std::endl;
+        }
+    }
+
+    try {
+        return harness::finish(records, options, NON_LIN_OPTIM_VERSION, {"problem", "optimizer"}, "time_median_ns");
+    } catch (std::exception& e){
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+}
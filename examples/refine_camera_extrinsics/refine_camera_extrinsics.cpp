@@ -131,6 +131,9 @@ int main(int argc, char** argv){
     };  
     
     auto optimizer = optim::GaussianNewton(reprojection_error, 10000, 1e-12, 1);
+    // the projections are differences of pixel coordinates around 1000, the adaptive Jacobian picks its schemes
+    // from the rounding error this leaves in the residuals
+    optimizer.set_adaptive_jacobian(true);
     auto result = optimizer.run(x);
     
     std::cout << "x:" << x << std::endl;
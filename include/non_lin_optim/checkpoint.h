@@ -0,0 +1,226 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "types.h"
+
+namespace non_lin_optim {
+
+namespace checkpoint {
+
+    // Checkpoint layout, values are stored in native byte order without padding:
+    //   char magic[4], uint32 version
+    //   loop state written by BaseMinimization::run (iteration, best x and error, convergence counters, RunStats)
+    //   bounded history of errors and steps
+    //   bool, true when followed by the state of the adaptive Jacobian
+    //   solver state written by the optimizer's save_state()
+    // Vectors are stored as an int64 size followed by their coefficients, bools as one byte 0 or 1.
+    constexpr char magic[4] = {'N', 'L', 'O', 'C'};
+    constexpr uint32_t version = 2;
+
+    class Writer {
+    private:
+        std::string bytes;
+
+    public:
+        Writer(){
+            bytes.append(magic, sizeof(magic));
+            put(version);
+        }
+
+        template<typename T>
+        void put(const T& value){
+            static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable values are written as is");
+            bytes.append(reinterpret_cast<const char*>(&value), sizeof(T));
+        }
+
+        void put(const Vector& v){
+            put(static_cast<int64_t>(v.size()));
+            bytes.append(reinterpret_cast<const char*>(v.data()), v.size()*sizeof(Scalar));
+        }
+
+        template<typename T>
+        void put(const std::vector<T>& values){
+            put(static_cast<int64_t>(values.size()));
+            for(const auto& value:values)
+                put(value);
+        }
+
+        std::string& data(){
+            return bytes;
+        }
+    };
+
+    class Reader {
+    private:
+        const std::string bytes;
+        size_t offset = 0;
+
+        const char* take(const size_t n){
+            if(n>bytes.size()-offset)
+                throw std::runtime_error("Truncated checkpoint!");
+            const char* p = bytes.data()+offset;
+            offset += n;
+            return p;
+        }
+
+        size_t take_size(const size_t element_size){
+            const int64_t n = get<int64_t>();
+            if(n<0 || static_cast<uint64_t>(n)>(bytes.size()-offset)/element_size)
+                throw std::runtime_error("Truncated checkpoint!");
+            return n;
+        }
+
+    public:
+        explicit Reader(std::string bytes) : bytes(std::move(bytes)) {
+            if(this->bytes.size()<sizeof(magic) || std::memcmp(take(sizeof(magic)), magic, sizeof(magic))!=0)
+                throw std::runtime_error("Not a checkpoint!");
+            if(get<uint32_t>()!=version)
+                throw std::runtime_error("Unsupported checkpoint version!");
+        }
+
+        template<typename T>
+        T get(){
+            static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable values are read as is");
+            if constexpr (std::is_same_v<T, bool>){
+                static_assert(sizeof(bool)==1, "Bools are stored as one byte");
+                const unsigned char byte = *take(1);
+                if(byte>1)
+                    throw std::runtime_error("Corrupt checkpoint!");
+                return byte==1;
+            }
+            T value;
+            std::memcpy(&value, take(sizeof(T)), sizeof(T));
+            return value;
+        }
+
+        void get(Vector& v){
+            v.resize(take_size(sizeof(Scalar)));
+            std::memcpy(v.data(), take(v.size()*sizeof(Scalar)), v.size()*sizeof(Scalar));
+        }
+
+        template<typename T>
+        void get(std::vector<T>& values){
+            values.resize(take_size(std::is_same_v<T, Vector> ? sizeof(int64_t) : sizeof(T)));
+            for(auto& value:values){
+                if constexpr (std::is_same_v<T, Vector>) get(value);
+                else value = get<T>();
+            }
+        }
+
+        // Throws when bytes are left, i.e. the checkpoint was written by another optimizer
+        void finish() const {
+            if(offset!=bytes.size())
+                throw std::runtime_error("Checkpoint does not match the optimizer!");
+        }
+    };
+
+    inline
+    Reader load(const std::string& path){
+        std::ifstream in(path, std::ios::binary);
+        if(!in)
+            throw std::runtime_error("Cannot open " + path + "!");
+        return Reader(std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()));
+    }
+
+    // Writes checkpoints to path on a background thread, replacing the file atomically through path.tmp.
+    // Only the latest checkpoint waiting to be written is kept, so a slow disk never stalls the caller.
+    class AsyncWriter {
+    private:
+        const std::string path;
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::optional<std::string> pending;
+        bool writing = false;
+        bool done = false;
+        std::string error;
+        std::thread thread;
+
+        void write(const std::string& bytes){
+            const std::string tmp = path + ".tmp";
+            {
+                std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+                out.write(bytes.data(), bytes.size());
+                if(!out) throw std::runtime_error("Failed writing " + tmp + "!");
+            }
+            if(std::rename(tmp.c_str(), path.c_str())!=0)
+                throw std::runtime_error("Cannot replace " + path + "!");
+        }
+
+        void loop(){
+            std::unique_lock<std::mutex> lock(mutex);
+            while(true){
+                cv.wait(lock, [&]{ return pending || done; });
+                if(!pending) return;
+                std::string bytes = std::move(*pending);
+                pending.reset();
+                writing = true;
+                lock.unlock();
+                std::string failure;
+                try {
+                    write(bytes);
+                } catch(const std::exception& e) {
+                    failure = e.what();
+                }
+                lock.lock();
+                writing = false;
+                if(!failure.empty()) error = failure;
+                cv.notify_all();
+            }
+        }
+
+        void throw_error(){
+            if(error.empty()) return;
+            std::string message;
+            std::swap(message, error);
+            throw std::runtime_error(message);
+        }
+
+    public:
+        explicit AsyncWriter(const std::string& path) : path(path) {
+            thread = std::thread([this]{ loop(); });
+        }
+
+        AsyncWriter(const AsyncWriter&) = delete;
+        AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+        // Writes the pending checkpoint before returning
+        ~AsyncWriter(){
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                done = true;
+            }
+            cv.notify_all();
+            thread.join();
+        }
+
+        // Queues a checkpoint, rethrows the failure of a previous write
+        void submit(std::string&& bytes){
+            std::lock_guard<std::mutex> lock(mutex);
+            throw_error();
+            pending = std::move(bytes);
+            cv.notify_all();
+        }
+
+        // Waits until the queued checkpoint is on disk, rethrows a write failure
+        void wait(){
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&]{ return !pending && !writing; });
+            throw_error();
+        }
+    };
+
+} // end namespace checkpoint
+
+} // end namespace non_lin_optim
@@ -0,0 +1,259 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "types.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace non_lin_optim {
+
+namespace io {
+
+    using Index = Eigen::Matrix< int32_t, 2, Eigen::Dynamic >;
+
+    // Binary problem layout, all sections are stored in native byte order and aligned to 8 bytes:
+    //   ProblemHeader
+    //   int32  indices[2*num_observations]                        (camera, point) per observation
+    //   Scalar observations[observation_size*num_observations]
+    //   Scalar parameters[camera_size*num_cameras + point_size*num_points]
+    struct ProblemHeader {
+        char magic[4] = {'N', 'L', 'O', 'P'};
+        uint32_t version = 1;
+        int64_t num_cameras = 0;
+        int64_t num_points = 0;
+        int64_t num_observations = 0;
+        int64_t camera_size = 9;
+        int64_t point_size = 3;
+        int64_t observation_size = 2;
+
+        int64_t num_parameters() const {
+            return camera_size*num_cameras + point_size*num_points;
+        }
+
+        static int64_t align(const int64_t offset){
+            return (offset+7) & ~int64_t(7);
+        }
+
+        int64_t indices_offset() const {
+            return align(sizeof(ProblemHeader));
+        }
+
+        int64_t observations_offset() const {
+            return align(indices_offset() + 2*num_observations*sizeof(int32_t));
+        }
+
+        int64_t parameters_offset() const {
+            return align(observations_offset() + observation_size*num_observations*sizeof(Scalar));
+        }
+
+        int64_t file_size() const {
+            return parameters_offset() + num_parameters()*sizeof(Scalar);
+        }
+
+        // Whether the counts and sizes are non-negative and every section ends within `size` bytes, computed
+        // without overflowing int64. The offsets above are only meaningful for a header passing this check.
+        bool fits(const int64_t size) const {
+            constexpr int64_t max = std::numeric_limits<int64_t>::max();
+            // -1 stands for a negative or overflowing value and propagates
+            auto add = [](const int64_t a, const int64_t b) -> int64_t {
+                return a<0 || b<0 || a>max-b ? -1 : a+b;
+            };
+            auto mul = [](const int64_t a, const int64_t b) -> int64_t {
+                return a<0 || b<0 || (b!=0 && a>max/b) ? -1 : a*b;
+            };
+            auto aligned = [&](const int64_t offset) -> int64_t {
+                return add(offset, 7)<0 ? -1 : align(offset);
+            };
+            const int64_t indices_end = add(indices_offset(), mul(mul(2, num_observations), sizeof(int32_t)));
+            const int64_t observations_end = add(aligned(indices_end), 
+                                                 mul(mul(observation_size, num_observations), sizeof(Scalar)));
+            const int64_t parameters = add(mul(camera_size, num_cameras), mul(point_size, num_points));
+            const int64_t end = add(aligned(observations_end), mul(parameters, sizeof(Scalar)));
+            return end>=0 && end<=size;
+        }
+    };
+
+    inline
+    void write_problem(const std::string& path, const ProblemHeader& header, const Index& indices,
+                       const Matrix& observations, const Vector& parameters){
+        if(indices.cols()!=header.num_observations || observations.cols()!=header.num_observations ||
+           observations.rows()!=header.observation_size || parameters.size()!=header.num_parameters())
+            throw std::invalid_argument("Problem sizes do not match the header!");
+
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        if(!out)
+            throw std::runtime_error("Cannot open " + path + " for writing!");
+
+        auto write_at = [&](const int64_t offset, const void* data, const int64_t bytes){
+            const std::vector<char> padding(offset - static_cast<int64_t>(out.tellp()), 0);
+            out.write(padding.data(), padding.size());
+            out.write(static_cast<const char*>(data), bytes);
+        };
+        write_at(0, &header, sizeof(ProblemHeader));
+        write_at(header.indices_offset(), indices.data(), indices.size()*sizeof(int32_t));
+        write_at(header.observations_offset(), observations.data(), observations.size()*sizeof(Scalar));
+        write_at(header.parameters_offset(), parameters.data(), parameters.size()*sizeof(Scalar));
+        if(!out)
+            throw std::runtime_error("Failed writing " + path + "!");
+    }
+
+    // Converts a text file of the Bundle-Adjustment-in-the-Large dataset to the binary format
+    inline
+    ProblemHeader convert_bal(const std::string& bal_path, const std::string& path){
+        std::ifstream in(bal_path);
+        if(!in)
+            throw std::runtime_error("Cannot open " + bal_path + "!");
+
+        ProblemHeader header;
+        in >> header.num_cameras >> header.num_points >> header.num_observations;
+        if(!in || header.num_cameras<0 || header.num_points<0 || header.num_observations<0)
+            throw std::runtime_error("Invalid BAL header in " + bal_path + "!");
+
+        Index indices(2, header.num_observations);
+        Matrix observations(header.observation_size, header.num_observations);
+        for(int64_t i=0; i<header.num_observations; ++i)
+            in >> indices(0, i) >> indices(1, i) >> observations(0, i) >> observations(1, i);
+
+        Vector parameters(header.num_parameters());
+        for(int64_t i=0; i<parameters.size(); ++i)
+            in >> parameters(i);
+
+        if(!in)
+            throw std::runtime_error("Truncated BAL file " + bal_path + "!");
+        if(header.num_observations>0 &&
+           (indices.row(0).minCoeff()<0 || indices.row(0).maxCoeff()>=header.num_cameras ||
+            indices.row(1).minCoeff()<0 || indices.row(1).maxCoeff()>=header.num_points))
+            throw std::runtime_error("Observation index out of range in " + bal_path + "!");
+
+        write_problem(path, header, indices, observations, parameters);
+        return header;
+    }
+
+    // Read-only memory mapping of a binary problem, the parameters are mapped copy-on-write
+    // so they can be optimized in place without modifying the file
+    class MappedProblem {
+    private:
+        ProblemHeader header;
+        char* data = nullptr;
+        int64_t size = 0;
+#ifdef _WIN32
+        HANDLE file = INVALID_HANDLE_VALUE;
+        HANDLE mapping = nullptr;
+#endif
+
+        void close(){
+#ifdef _WIN32
+            if(data) UnmapViewOfFile(data);
+            if(mapping) CloseHandle(mapping);
+            if(file!=INVALID_HANDLE_VALUE) CloseHandle(file);
+            mapping = nullptr;
+            file = INVALID_HANDLE_VALUE;
+#else
+            if(data) munmap(data, size);
+#endif
+            data = nullptr;
+            size = 0;
+        }
+
+    public:
+        explicit MappedProblem(const std::string& path){
+#ifdef _WIN32
+            file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if(file==INVALID_HANDLE_VALUE)
+                throw std::runtime_error("Cannot open " + path + "!");
+            LARGE_INTEGER file_size;
+            if(!GetFileSizeEx(file, &file_size)){
+                close();
+                throw std::runtime_error("Cannot stat " + path + "!");
+            }
+            size = file_size.QuadPart;
+            mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+            if(mapping) data = static_cast<char*>(MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0));
+            if(!data){
+                close();
+                throw std::runtime_error("Cannot map " + path + "!");
+            }
+#else
+            const int fd = ::open(path.c_str(), O_RDONLY);
+            if(fd<0)
+                throw std::runtime_error("Cannot open " + path + "!");
+            struct stat st;
+            if(fstat(fd, &st)!=0){
+                ::close(fd);
+                throw std::runtime_error("Cannot stat " + path + "!");
+            }
+            size = st.st_size;
+            void* ptr = size>0 ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+            ::close(fd);
+            if(ptr==MAP_FAILED){
+                size = 0;
+                throw std::runtime_error("Cannot map " + path + "!");
+            }
+            data = static_cast<char*>(ptr);
+#endif
+            if(size<static_cast<int64_t>(sizeof(ProblemHeader))){
+                close();
+                throw std::runtime_error(path + " is too small to be a problem file!");
+            }
+            std::memcpy(&header, data, sizeof(ProblemHeader));
+            if(std::memcmp(header.magic, ProblemHeader().magic, 4)!=0 || header.version!=ProblemHeader().version){
+                close();
+                throw std::runtime_error(path + " is not a problem file!");
+            }
+            if(!header.fits(size)){
+                close();
+                throw std::runtime_error(path + " is truncated or has an invalid header!");
+            }
+        }
+
+        MappedProblem(const MappedProblem&) = delete;
+        MappedProblem& operator=(const MappedProblem&) = delete;
+
+        ~MappedProblem(){
+            close();
+        }
+
+        const ProblemHeader& info() const {
+            return header;
+        }
+
+        Eigen::Map<const Index> indices() const {
+            return {reinterpret_cast<const int32_t*>(data + header.indices_offset()), 2, header.num_observations};
+        }
+
+        Eigen::Map<const Matrix> observations() const {
+            return {reinterpret_cast<const Scalar*>(data + header.observations_offset()), header.observation_size, header.num_observations};
+        }
+
+        Eigen::Map<Vector> parameters(){
+            return {reinterpret_cast<Scalar*>(data + header.parameters_offset()), header.num_parameters()};
+        }
+
+        Eigen::Map<Vector> camera(const int64_t i){
+            return {parameters().data() + i*header.camera_size, header.camera_size};
+        }
+
+        Eigen::Map<Vector> point(const int64_t i){
+            return {parameters().data() + header.num_cameras*header.camera_size + i*header.point_size, header.point_size};
+        }
+    };
+
+} // end namespace io
+
+} // end namespace non_lin_optim
@@ -1,8 +1,17 @@
 #pragma once
 
 #include "types.h"
+#include "checkpoint.h"
+#include "parallel.h"
+#include "trace.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <iostream>
+#include <limits>
 #include <math.h>
+#include <stdexcept>
+#include <vector>
 
 namespace non_lin_optim {
 
@@ -10,6 +19,7 @@ namespace numerical_deriv {
     
     inline
     Matrix JacobianApprox(const Func_s& func, Vector& x, const Scalar step=1e-6){
+        NON_LIN_OPTIM_TRACE_SCOPE_ARG("numerical_deriv", "gradient", "n", x.size());
         Scalar f_x = func(x);
         Vector J(x.size());
         
@@ -24,10 +34,12 @@ namespace numerical_deriv {
 
     inline
     Matrix JacobianApprox(const Func_v& func, Vector& x, const Scalar step=1e-6){
+        NON_LIN_OPTIM_TRACE_SCOPE_ARG("numerical_deriv", "jacobian", "n", x.size());
         Vector f_x = func(x);
         Matrix J(f_x.size(), x.size());
         
         for(int i=0; i<x.size(); ++i){
+            NON_LIN_OPTIM_TRACE_SCOPE_ARG("numerical_deriv", "jacobian column", "column", i);
             x(i) += step;
             Vector f_x_p = func(x);
             x(i) -= step;   
@@ -38,11 +50,13 @@ namespace numerical_deriv {
 
     inline
     Matrix JacobianApproxCentral(const Func_v& func, Vector& x, const Scalar step=1e-6){
+        NON_LIN_OPTIM_TRACE_SCOPE_ARG("numerical_deriv", "central jacobian", "n", x.size());
 
         Vector f_x = func(x);
         Matrix J(f_x.size(), x.size());
         
         for(int i=0; i<x.size(); ++i){
+            NON_LIN_OPTIM_TRACE_SCOPE_ARG("numerical_deriv", "jacobian column", "column", i);
             x(i) += step;
             Vector f_x_p = func(x);
             x(i) -= 2*step;  
@@ -53,10 +67,248 @@ namespace numerical_deriv {
         return J;
     }
 
+    // J^T r for the central difference Jacobian J of func at x, accumulated column by column so that J is never
+    // stored, in O(m+n) memory and 2n evaluations
     inline
-    Matrix HessianApprox(const Func_s& func, Vector& x, const Scalar step=1e-6){
+    Vector GradientApproxCentral(const Func_v& func, Vector& x, const Vector& r, const Scalar step=1e-6){
+        NON_LIN_OPTIM_TRACE_SCOPE_ARG("numerical_deriv", "central gradient", "n", x.size());
+        Vector g(x.size());
+
+        for(int i=0; i<x.size(); ++i){
+            x(i) += step;
+            Vector f_x_p = func(x);
+            x(i) -= 2*step;
+            Vector f_x_n = func(x);
+            x(i) += step;
+            g(i) = (f_x_p-f_x_n).dot(r)/(2*step);
+        }
+        return g;
+    }
+
+    // J*d for the Jacobian of func at x, central difference along d in 2 evaluations
+    inline
+    Vector JacobianProductCentral(const Func_v& func, const Vector& x, const Vector& d, const Scalar step=1e-6){
+        NON_LIN_OPTIM_TRACE_SCOPE_ARG("numerical_deriv", "central jacobian product", "n", x.size());
+        const Scalar norm = d.norm();
+        if(norm==0) return Vector::Zero(func(x).size());
+        const Scalar h = step/norm;
+        return (func(x+h*d)-func(x-h*d))/(2*h);
+    }
+
+    // Step of each parameter relative to its magnitude, step*max(|x_i|, 1)
+    inline
+    Vector RelativeSteps(const Vector& x, const Scalar step=1e-6){
+        return step*x.cwiseAbs().cwiseMax(Scalar(1));
+    }
+
+    inline
+    Matrix JacobianApprox(const Func_v& func, Vector& x, const Vector& steps){
+        NON_LIN_OPTIM_TRACE_SCOPE_ARG("numerical_deriv", "jacobian", "n", x.size());
+        Vector f_x = func(x);
+        Matrix J(f_x.size(), x.size());
+
+        for(int i=0; i<x.size(); ++i){
+            const Scalar x_i = x(i);
+            x(i) += steps(i);
+            const Scalar h = x(i)-x_i; // step actually represented
+            Vector f_x_p = func(x);
+            x(i) = x_i;
+            J.col(i) = (f_x_p-f_x)/h;
+        }
+        return J;
+    }
+
+    inline
+    Matrix JacobianApproxCentral(const Func_v& func, Vector& x, const Vector& steps){
+        NON_LIN_OPTIM_TRACE_SCOPE_ARG("numerical_deriv", "central jacobian", "n", x.size());
+        Matrix J;
+
+        for(int i=0; i<x.size(); ++i){
+            const Scalar x_i = x(i);
+            x(i) = x_i+steps(i);
+            const Scalar x_p = x(i);
+            Vector f_x_p = func(x);
+            x(i) = x_i-steps(i);
+            const Scalar x_n = x(i);
+            Vector f_x_n = func(x);
+            x(i) = x_i;
+            if(i==0) J.resize(f_x_p.size(), x.size());
+            J.col(i) = (f_x_p-f_x_n)/(x_p-x_n);
+        }
+        return J;
+    }
+
+    enum class Scheme {
+        Forward,    // 1 evaluation, step sqrt(eps)
+        Central,    // 2 evaluations, step eps^(1/3)
+        Richardson  // 4 evaluations, central differences at h and h/2 extrapolated, step eps^(1/5)
+    };
+
+    // Jacobian with relative steps and a difference scheme picked per column. The first call, and every `refresh`
+    // calls, extrapolates every column and measures the error of the cheaper schemes against it. Each column then
+    // uses the cheapest scheme whose error is below tolerance*max(|J column|, 1). The error is the larger of the
+    // measured one and of the truncation plus rounding error predicted from the magnitude of the residuals, the
+    // measurement catches the rounding of residuals differencing large values, e.g. a model and its data.
+    class AdaptiveJacobian {
+    private:
+        const Scalar tolerance;
+        const int refresh;
+        std::vector<Scheme> schemes_;
+        Vector curvature2;  // max |d2 f / dx_i^2| over the residuals
+        Vector curvature3;  // max |d3 f / dx_i^3|
+        Vector measured;    // error of the scheme of each column measured at the last refresh
+        Vector errors_;
+        int64_t calls = 0;
+        int64_t evaluations_ = 0;
+
+        void reset(const int n){
+            schemes_.assign(n, Scheme::Richardson);
+            curvature2 = Vector::Zero(n);
+            curvature3 = Vector::Zero(n);
+            measured = Vector::Zero(n);
+            errors_ = Vector::Zero(n);
+            calls = 0;
+        }
+
+    public:
+        explicit AdaptiveJacobian(const Scalar tolerance=1e-6, const int refresh=10)
+        : tolerance(tolerance), refresh(std::max(refresh, 1)) {}
+
+        // Forgets the schemes, the next call extrapolates every column
+        void restart(){
+            reset(schemes_.size());
+        }
+
+        Matrix operator()(const Func_v& func, Vector& x){
+            NON_LIN_OPTIM_TRACE_SCOPE_ARG("numerical_deriv", "adaptive jacobian", "n", x.size());
+            constexpr Scalar eps = std::numeric_limits<Scalar>::epsilon();
+            const int n = x.size();
+            if(static_cast<int>(schemes_.size())!=n) reset(n);
+            const bool extrapolate_all = calls++ % refresh == 0;
+
+            const Vector f_x = func(x);
+            ++evaluations_;
+            Matrix J(f_x.size(), n);
+
+            // residuals at x_i+h, h is updated to the step actually represented
+            auto at = [&](const int i, Scalar& h){
+                const Scalar x_i = x(i);
+                x(i) += h;
+                h = x(i)-x_i;
+                Vector f = func(x);
+                x(i) = x_i;
+                ++evaluations_;
+                return f;
+            };
+            auto max_abs = [](const Vector& v){ return v.size()>0 ? v.cwiseAbs().maxCoeff() : Scalar(0); };
+            const Scalar f_scale_x = max_abs(f_x);
+
+            for(int i=0; i<n; ++i){
+                const Scalar scale = std::max(std::abs(x(i)), Scalar(1));
+                const Scheme scheme = extrapolate_all ? Scheme::Richardson : schemes_[i];
+                if(scheme==Scheme::Forward){
+                    Scalar h = std::sqrt(eps)*scale;
+                    const Vector f_p = at(i, h);
+                    J.col(i) = (f_p-f_x)/h;
+                    const Scalar f_scale = std::max(f_scale_x, max_abs(f_p));
+                    errors_(i) = std::max(curvature2(i)*h/2 + 2*eps*f_scale/h, measured(i));
+                    continue;
+                }
+                if(scheme==Scheme::Central){
+                    Scalar h_p = std::cbrt(eps)*scale, h_n = -h_p;
+                    const Vector f_p = at(i, h_p);
+                    const Vector f_n = at(i, h_n);
+                    J.col(i) = (f_p-f_n)/(h_p-h_n);
+                    curvature2(i) = max_abs((f_p+f_n-2*f_x)/(h_p*h_p));
+                    const Scalar f_scale = std::max({f_scale_x, max_abs(f_p), max_abs(f_n)});
+                    errors_(i) = std::max(curvature3(i)*h_p*h_p/6 + eps*f_scale/h_p, measured(i));
+                    continue;
+                }
+
+                Scalar h_p = std::pow(eps, Scalar(0.2))*scale, h_n = -h_p;
+                Scalar h2_p = h_p/2, h2_n = -h2_p;
+                const Vector f_p = at(i, h_p);
+                const Vector f_n = at(i, h_n);
+                const Vector f2_p = at(i, h2_p);
+                const Vector f2_n = at(i, h2_n);
+                const Vector D = (f_p-f_n)/(h_p-h_n);
+                const Vector D2 = (f2_p-f2_n)/(h2_p-h2_n);
+                J.col(i) = (4*D2-D)/3;
+                // D - D2 = f''' (h^2 - h^2/4)/6
+                curvature2(i) = max_abs((f2_p+f2_n-2*f_x)/(h2_p*h2_p));
+                curvature3(i) = 8*max_abs(D-D2)/(h_p*h_p);
+                const Scalar f_scale = std::max({f_scale_x, max_abs(f_p), max_abs(f_n), max_abs(f2_p), max_abs(f2_n)});
+                errors_(i) = max_abs(D-D2)/3 + eps*f_scale/h2_p;
+                if(!extrapolate_all) continue;
+
+                // measures the cheaper schemes against the extrapolated column, taken as exact
+                const Scalar bound = tolerance*std::max(max_abs(J.col(i)), Scalar(1));
+                Scalar h_f = std::sqrt(eps)*scale;
+                const Vector f_f = at(i, h_f);
+                const Scalar f_scale_f = std::max(f_scale_x, max_abs(f_f));
+                const Scalar error_f = std::max(curvature2(i)*h_f/2 + 2*eps*f_scale_f/h_f,
+                                                max_abs((f_f-f_x)/h_f - J.col(i)));
+                if(error_f<=bound){
+                    schemes_[i] = Scheme::Forward;
+                    measured(i) = error_f;
+                    continue;
+                }
+                Scalar h_cp = std::cbrt(eps)*scale, h_cn = -h_cp;
+                const Vector f_cp = at(i, h_cp);
+                const Vector f_cn = at(i, h_cn);
+                const Scalar f_scale_c = std::max({f_scale_x, max_abs(f_cp), max_abs(f_cn)});
+                const Scalar error_c = std::max(curvature3(i)*h_cp*h_cp/6 + eps*f_scale_c/h_cp,
+                                                max_abs((f_cp-f_cn)/(h_cp-h_cn) - J.col(i)));
+                if(error_c<=bound){
+                    schemes_[i] = Scheme::Central;
+                    measured(i) = error_c;
+                } else {
+                    schemes_[i] = Scheme::Richardson;
+                    measured(i) = 0;
+                }
+            }
+            return J;
+        }
+
+        // Estimated absolute error of each column of the last Jacobian, at least the one measured at the last refresh
+        const Vector& errors() const {
+            return errors_;
+        }
+
+        // Schemes of the next Jacobian
+        const std::vector<Scheme>& schemes() const {
+            return schemes_;
+        }
+
+        // Function evaluations made so far
+        int64_t evaluations() const {
+            return evaluations_;
+        }
+
+        void save(checkpoint::Writer& out) const {
+            out.put(calls);
+            out.put(schemes_);
+            out.put(curvature2);
+            out.put(curvature3);
+            out.put(measured);
+        }
+
+        void load(checkpoint::Reader& in){
+            calls = in.get<int64_t>();
+            in.get(schemes_);
+            in.get(curvature2);
+            in.get(curvature3);
+            in.get(measured);
+            errors_ = Vector::Zero(schemes_.size());
+        }
+    };
+
+    // Writes the Hessian into H, which is only reallocated when its size changes
+    inline
+    void HessianApprox(const Func_s& func, Vector& x, Matrix& H, const Scalar step=1e-6){
+        NON_LIN_OPTIM_TRACE_SCOPE_ARG("numerical_deriv", "hessian", "n", x.size());
         Scalar f_x = func(x);
-        Matrix H(x.size(), x.size());
+        H.resize(x.size(), x.size());
         
         for(int i=0; i<x.size(); ++i){
             for(int j=i; j<x.size(); ++j){
@@ -91,9 +343,143 @@ namespace numerical_deriv {
                 }
             }
         }
-        return H;
     } 
 
+    inline
+    Matrix HessianApprox(const Func_s& func, Vector& x, const Scalar step=1e-6){
+        Matrix H;
+        HessianApprox(func, x, H, step);
+        return H;
+    }
+
+    // Batched variants: every point of the stencil is a column of one matrix passed in a single call
+
+    inline
+    Vector GradientApproxBatch(const Func_batch_s& func, const Vector& x, const Scalar step=1e-6){
+        NON_LIN_OPTIM_TRACE_SCOPE_ARG("numerical_deriv", "batched gradient", "n", x.size());
+        const int n = x.size();
+        Matrix X = x.replicate(1, n+1);
+        for(int i=0; i<n; ++i)
+            X(i, i+1) += step;
+        const Vector f = func(X);
+        if(f.size()!=n+1)
+            throw std::invalid_argument("The batched function must return one value per column!");
+        return (f.tail(n).array()-f(0))/step;
+    }
+
+    inline
+    Matrix JacobianApproxBatch(const Func_batch_v& func, const Vector& x, const Scalar step=1e-6){
+        NON_LIN_OPTIM_TRACE_SCOPE_ARG("numerical_deriv", "batched jacobian", "n", x.size());
+        const int n = x.size();
+        Matrix X = x.replicate(1, n+1);
+        for(int i=0; i<n; ++i)
+            X(i, i+1) += step;
+        const Matrix F = func(X);
+        if(F.cols()!=n+1)
+            throw std::invalid_argument("The batched function must return one column per point!");
+        return (F.rightCols(n).colwise()-F.col(0))/step;
+    }
+
+    inline
+    Matrix JacobianApproxCentralBatch(const Func_batch_v& func, const Vector& x, const Scalar step=1e-6){
+        NON_LIN_OPTIM_TRACE_SCOPE_ARG("numerical_deriv", "batched central jacobian", "n", x.size());
+        const int n = x.size();
+        Matrix X = x.replicate(1, 2*n);
+        for(int i=0; i<n; ++i){
+            X(i, 2*i) += step;
+            X(i, 2*i+1) -= step;
+        }
+        const Matrix F = func(X);
+        if(F.cols()!=2*n)
+            throw std::invalid_argument("The batched function must return one column per point!");
+        Matrix J(F.rows(), n);
+        for(int i=0; i<n; ++i)
+            J.col(i) = (F.col(2*i)-F.col(2*i+1))/(2*step);
+        return J;
+    }
+
+    // Same stencils as HessianApprox: 4 points per diagonal and 4 per upper off-diagonal entry around x,
+    // written into H, which is only reallocated when its size changes
+    inline
+    void HessianApproxBatch(const Func_batch_s& func, const Vector& x, Matrix& H, const Scalar step=1e-6){
+        NON_LIN_OPTIM_TRACE_SCOPE_ARG("numerical_deriv", "batched hessian", "n", x.size());
+        const int n = x.size();
+        Matrix X = x.replicate(1, 1+2*n*(n+1));
+        int c = 1;
+        for(int i=0; i<n; ++i){
+            for(int j=i; j<n; ++j, c+=4){
+                if(i==j){
+                    X(i, c) += step;
+                    X(i, c+1) += 2*step;
+                    X(i, c+2) -= step;
+                    X(i, c+3) -= 2*step;
+                } else {
+                    X(i, c) += step;   X(j, c) += step;
+                    X(i, c+1) -= step; X(j, c+1) += step;
+                    X(i, c+2) -= step; X(j, c+2) -= step;
+                    X(i, c+3) += step; X(j, c+3) -= step;
+                }
+            }
+        }
+        const Vector f = func(X);
+        if(f.size()!=X.cols())
+            throw std::invalid_argument("The batched function must return one value per column!");
+
+        H.resize(n, n);
+        c = 1;
+        for(int i=0; i<n; ++i){
+            for(int j=i; j<n; ++j, c+=4){
+                if(i==j){
+                    H(i,j) = (-f(c+1) + 16*f(c) - 30*f(0) + 16*f(c+2) - f(c+3))/(12*step*step);
+                } else {
+                    H(i,j) = (f(c) - f(c+3) - f(c+1) + f(c+2))/(4*step*step);
+                    H(j,i) = H(i,j);
+                }
+            }
+        }
+    }
+
+    inline
+    Matrix HessianApproxBatch(const Func_batch_s& func, const Vector& x, const Scalar step=1e-6){
+        Matrix H;
+        HessianApproxBatch(func, x, H, step);
+        return H;
+    }
+
+    // Accumulates J^T J and J^T r chunk by chunk without storing the full Jacobian, returns the squared error.
+    // Every worker of the pool sums its chunks into its own system, the systems are reduced at the end, so memory
+    // is O(workers*n^2 + workers*chunk*n) whatever the number of chunks.
+    inline
+    Scalar NormalEquationsApprox(const Func_chunk& func, const int num_chunks, const Vector& x,
+                                 Matrix& JtJ, Vector& Jtr, parallel::ThreadPool* pool=nullptr, const Scalar step=1e-6){
+        NON_LIN_OPTIM_TRACE_SCOPE_ARG("numerical_deriv", "normal equations", "chunks", num_chunks);
+        const int n = x.size();
+        const int workers = parallel::num_workers(pool);
+        std::vector<Matrix> JtJs(workers, Matrix::Zero(n, n));
+        std::vector<Vector> Jtrs(workers, Vector::Zero(n));
+        std::vector<Vector> xs(workers, x);
+        std::vector<Scalar> errors(workers, 0);
+
+        parallel::parallel_for(pool, num_chunks, [&](const int worker, const int chunk){
+            NON_LIN_OPTIM_TRACE_SCOPE_ARG("numerical_deriv", "chunk", "chunk", chunk);
+            Func_v func_chunk = [&](const Vector& x_){ return func(x_, chunk); };
+            Vector r = func_chunk(xs[worker]);
+            Matrix J = JacobianApproxCentral(func_chunk, xs[worker], Vector::Constant(n, step)); // no evaluation at x
+            JtJs[worker].selfadjointView<Eigen::Lower>().rankUpdate(J.transpose());
+            Jtrs[worker].noalias() += J.transpose()*r;
+            errors[worker] += r.squaredNorm();
+        });
+
+        for(int i=1; i<workers; ++i){
+            JtJs[0] += JtJs[i];
+            Jtrs[0] += Jtrs[i];
+            errors[0] += errors[i];
+        }
+        JtJ = JtJs[0].selfadjointView<Eigen::Lower>();
+        Jtr = std::move(Jtrs[0]);
+        return errors[0];
+    }
+
 } // end namespace numerical_deriv
 
 } // end namespace non_lin_optim
\ No newline at end of file
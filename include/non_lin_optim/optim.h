@@ -1,11 +1,25 @@
 #pragma once
 
 #include <math.h>
+#include <algorithm>
+#include <concepts>
 #include <iostream>
 #include <stdexcept>
+#include <future>
+#include <memory>
+#include <numbers>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <stop_token>
+#include <string>
 #include "types.h"
+#include "checkpoint.h"
 #include "numerical_deriv.h"
 #include "solvelin.h"
+#include "parallel.h"
+#include "problem.h"
+#include "trace.h"
 
 namespace non_lin_optim {
 
@@ -21,87 +35,967 @@ namespace optim {
 
         std::vector<Scalar> errors;
         std::vector<Vector> deltas;
+        RunStats stats;
+        Func_batch_v batch;
+        std::optional<numerical_deriv::AdaptiveJacobian> adaptive;
+        std::shared_ptr<parallel::ThreadPool> speculation;
 
-    public:
-        BaseMinimization(const Func& f, const int max_iter=10000, const Scalar tol=1e-12, const Scalar lambda=1)
-        : f(f), max_iter(max_iter), tol(tol), lambda(lambda) {}
+        // counters compile to nothing when NON_LIN_OPTIM_STATS is 0
+        void count(int& counter, const int n=1){
+            if constexpr (collect_stats) counter += n;
+        }
 
-        virtual Scalar compute_error(Vector& x) = 0;
+        void count(const solvelin::SymmetricSolver<Matrix>& solver){
+            if(solver.method()!=solvelin::Method::LDLT) count(stats.fallbacks);
+        }
 
-        virtual Vector compute_delta(Vector& x) = 0;
+        // g is only evaluated when statistics are collected
+        template<typename T>
+        void record_gradient(const Eigen::MatrixBase<T>& g){
+            if constexpr (collect_stats) stats.gradient_norm = g.norm();
+        }
 
-        ResultInfo run(Vector& x){
+        // Residuals at a trial point within compute_delta, counted and timed
+        Vector evaluate(const Vector& x){
+            ScopedTimer timer(stats.residual_time);
+            count(stats.residual_evaluations);
+            return f(x);
+        }
+
+        // Residuals at several trial points, evaluated concurrently when speculation is enabled
+        std::vector<Vector> evaluate(const std::vector<Vector>& xs){
+            ScopedTimer timer(stats.residual_time);
+            const int n = xs.size();
+            count(stats.residual_evaluations, n);
+            std::vector<Vector> rs(n);
+            parallel::parallel_for(speculation.get(), n, [&](const int, const int i){
+                rs[i] = f(xs[i]);
+            });
+            return rs;
+        }
+
+        // Number of candidate steps tried at once
+        int speculative_width() const {
+            return parallel::num_workers(speculation.get());
+        }
+
+        // Tries `candidates` step lengths or trust-region radii at once on as many threads, where an optimizer would
+        // otherwise retry them one after the other, and accepts the best step passing its acceptance test. The
+        // residual function must then be safe to call concurrently. 1 disables it. Made public by the optimizers
+        // using speculative_width() and evaluate(xs), Dogleg and ConjugateGradient.
+        void set_speculation(const int candidates){
+            if(candidates>1) speculation = std::make_shared<parallel::ThreadPool>(candidates);
+            else speculation.reset();
+        }
+
+        // Central difference Jacobian, counted and timed, adaptive or in a single call when enabled
+        Matrix jacobian(Vector& x){
+            ScopedTimer timer(stats.jacobian_time);
+            count(stats.jacobian_evaluations);
+            if(adaptive) return (*adaptive)(f, x);
+            if(batch) return numerical_deriv::JacobianApproxCentralBatch(batch, x);
+            return numerical_deriv::JacobianApproxCentral(f, x);
+        }
+
+        // Gradient J^T r of ||r||^2/2 at x, counted and timed as a Jacobian. The central differences are accumulated
+        // column by column without storing J, unless the Jacobian is adaptive or batched, which forms it whole.
+        Vector gradient(Vector& x, const Vector& r){
+            if(adaptive || batch) return jacobian(x).transpose()*r;
+            ScopedTimer timer(stats.jacobian_time);
+            count(stats.jacobian_evaluations);
+            return numerical_deriv::GradientApproxCentral(f, x, r);
+        }
 
-            double prev_error = std::numeric_limits<Scalar>::max();
-            int convergence_count = 0;
-            for(int i=0; i<max_iter; ++i) {
+        // Solver state beyond x carried from one iteration to the next, saved in checkpoints.
+        // load_state() replaces begin_run() when resuming.
+        virtual void save_state(checkpoint::Writer&) const {}
 
-                Scalar error = compute_error(x);
+        virtual void load_state(checkpoint::Reader&) {}
+
+    private:
+        std::shared_ptr<checkpoint::AsyncWriter> checkpointer;
+        int checkpoint_every = 0;
+        int checkpoint_history = 100;
+
+        struct LoopState {
+            int iteration;
+            Scalar best_error;
+            Vector best_x;
+            Scalar prev_error;
+            int convergence_count;
+        };
+
+        // Serializes the state at the start of an iteration on the calling thread and hands it to the writer
+        void save_checkpoint(const Vector& x, const LoopState& state, const Clock::duration elapsed){
+            auto tail = [&](const auto& history){
+                const size_t n = std::min(history.size(), static_cast<size_t>(checkpoint_history));
+                return std::vector<typename std::decay_t<decltype(history)>::value_type>(history.end()-n, history.end());
+            };
+            RunStats saved = stats;
+            saved.total_time += elapsed;
+            checkpoint::Writer out;
+            out.put(state.iteration);
+            out.put(state.best_error);
+            out.put(state.prev_error);
+            out.put(state.convergence_count);
+            out.put(x);
+            out.put(state.best_x);
+            out.put(saved);
+            out.put(tail(errors));
+            out.put(tail(deltas));
+            out.put(adaptive.has_value());
+            if(adaptive) adaptive->save(out);
+            save_state(out);
+            checkpointer->submit(std::move(out.data()));
+        }
+
+        ResultInfo iterate(Vector& x, LoopState state, std::stop_token stop, const Clock::time_point deadline,
+                           const Progress& progress){
+
+            NON_LIN_OPTIM_TRACE_SCOPE("optim", "run");
+            const bool has_deadline = deadline!=Clock::time_point::max();
+            const Clock::time_point started = Clock::now();
+            ScopedTimer timer(stats.total_time);
+
+            auto finish = [&](const ResultInfo info, const Scalar error, const int iterations){
+                stats.termination = info;
+                stats.iterations = iterations;
+                stats.final_error = error;
+                if(checkpointer) checkpointer->wait();
+                return info;
+            };
+
+            for(int& i=state.iteration; i<max_iter; ++i) {
+                NON_LIN_OPTIM_TRACE_SCOPE_ARG("optim", "iteration", "iteration", i);
+
+                if(checkpointer && i>0 && i%checkpoint_every==0)
+                    save_checkpoint(x, state, Clock::now()-started);
+
+                Scalar error;
+                {
+                    NON_LIN_OPTIM_TRACE_SCOPE("optim", "compute_error");
+                    ScopedTimer residual_timer(stats.residual_time);
+                    error = compute_error(x);
+                }
                 errors.push_back(error);
+                if(error<state.best_error){
+                    state.best_error = error;
+                    state.best_x = x;
+                }
+                if(progress) progress(i, error, x);
 
-                if(error<tol) return TolleranceReached;
+                if(error<tol) return finish(TolleranceReached, error, i+1);
                 if(i%100==0){
-                    if(error<prev_error){
-                        prev_error = error;
-                        convergence_count = 0;
+                    if(error<state.prev_error){
+                        state.prev_error = error;
+                        state.convergence_count = 0;
                     }else{
-                        convergence_count++;
-                        if(convergence_count>10)
-                            return Converged;
+                        state.convergence_count++;
+                        if(state.convergence_count>10)
+                            return finish(Converged, error, i+1);
                     }
                 }
 
-                Vector delta = compute_delta(x);
+                if(stop.stop_requested()){
+                    x = state.best_x;
+                    return finish(Stopped, state.best_error, i+1);
+                }
+                if(has_deadline && Clock::now()>=deadline){
+                    x = state.best_x;
+                    return finish(DeadlineReached, state.best_error, i+1);
+                }
+
+                Vector delta;
+                {
+                    NON_LIN_OPTIM_TRACE_SCOPE("optim", "compute_delta");
+                    delta = compute_delta(x);
+                }
                 deltas.push_back(delta);
-                
+
                 x = x+lambda*delta;
             }
-            return MaxIterationReached;
+            return finish(MaxIterationReached, errors.empty() ? std::numeric_limits<Scalar>::quiet_NaN() : errors.back(),
+                          std::max(max_iter, 0));
+        }
+
+    public:
+        BaseMinimization(const Func& f, const int max_iter=10000, const Scalar tol=1e-12, const Scalar lambda=1)
+        : f(f), max_iter(max_iter), tol(tol), lambda(lambda) {}
+
+        virtual Scalar compute_error(Vector& x) = 0;
+
+        virtual Vector compute_delta(Vector& x) = 0;
+
+        virtual void begin_run(Vector&) {}
+
+        ResultInfo run(Vector& x){
+            return run(x, std::stop_token(), Clock::time_point::max());
+        }
+
+        // Stops early when `stop` is requested or `deadline` has passed, leaving the best iterate found so far in x
+        ResultInfo run(Vector& x, std::stop_token stop, const Clock::time_point deadline, const Progress& progress=nullptr){
+            errors.clear();
+            deltas.clear();
+            stats = RunStats();
+            if(adaptive) adaptive->restart();
+            begin_run(x);
+            return iterate(x, LoopState{0, std::numeric_limits<Scalar>::max(), x, std::numeric_limits<Scalar>::max(), 0},
+                           stop, deadline, progress);
+        }
+
+        // Continues the run saved in the checkpoint at path, reaching the same x and statistics (but timings) as if
+        // it had not been interrupted. x is overwritten with the saved iterate.
+        ResultInfo resume(Vector& x, const std::string& path){
+            return resume(x, path, std::stop_token(), Clock::time_point::max());
+        }
+
+        ResultInfo resume(Vector& x, const std::string& path, std::stop_token stop, const Clock::time_point deadline,
+                          const Progress& progress=nullptr){
+            checkpoint::Reader in = checkpoint::load(path);
+            LoopState state;
+            state.iteration = in.get<int>();
+            state.best_error = in.get<Scalar>();
+            state.prev_error = in.get<Scalar>();
+            state.convergence_count = in.get<int>();
+            in.get(x);
+            in.get(state.best_x);
+            stats = in.get<RunStats>();
+            in.get(errors);
+            in.get(deltas);
+            if(in.get<bool>()!=adaptive.has_value())
+                throw std::runtime_error("Checkpoint does not match the optimizer!");
+            if(adaptive) adaptive->load(in);
+            load_state(in);
+            in.finish();
+            return iterate(x, state, stop, deadline, progress);
+        }
+
+        // Saves a checkpoint to path every `every` iterations, keeping the last `history` errors and steps.
+        // Checkpoints are written on a background thread, a failed write is thrown by the next one or at the end
+        // of the run. every<=0 disables checkpointing.
+        void set_checkpoint(const std::string& path, const int every=100, const int history=100){
+            checkpointer.reset();
+            checkpoint_every = every;
+            checkpoint_history = std::max(history, 1);
+            if(every>0) checkpointer = std::make_shared<checkpoint::AsyncWriter>(path);
+        }
+
+        // Residuals of many points in one call, used for the finite-difference Jacobians of the optimizers on Func_v.
+        // It must match the residual function column by column.
+        void set_batch(const Func_batch_v& batch) requires std::same_as<Func, Func_v> {
+            this->batch = batch;
+        }
+
+        // Differentiates the optimizers on Func_v with relative steps and a scheme per column meeting the relative
+        // tolerance, see numerical_deriv::AdaptiveJacobian. It takes precedence over the batched function, every run starts by
+        // extrapolating all columns again.
+        void set_adaptive_jacobian(const bool enable, const Scalar tolerance=1e-6) requires std::same_as<Func, Func_v> {
+            if(enable) adaptive.emplace(tolerance);
+            else adaptive.reset();
+        }
+
+        // Report of the last run
+        const RunStats& statistics() const {
+            return stats;
+        }
+
+        // The optimizer must outlive the returned future, progress is reported from the worker thread
+        std::future<AsyncResult> run_async(Vector x, std::stop_token stop={}, 
+                                           const Clock::time_point deadline=Clock::time_point::max(), 
+                                           Progress progress=nullptr){
+            return std::async(std::launch::async, [this, x, stop, deadline, progress]() mutable {
+                ResultInfo info = run(x, stop, deadline, progress);
+                return AsyncResult{info, x, stats};
+            });
         }
     }; 
 
     class Newton : public BaseMinimization<Func_s> {
+    private:
+        Matrix H;
+        solvelin::SymmetricSolver<Matrix> solver;
+        Func_batch_s batch_s;
     public:        
-        Newton(const Func_s& f, const int max_iter=10000, const Scalar tol=1e-12, const Scalar lambda=1)
-        : BaseMinimization(f, max_iter, tol, lambda) {}
+        Newton(const Func_s& f, const int max_iter=10000, const Scalar tol=1e-12, const Scalar lambda=1,
+               const solvelin::FallbackOptions& fallback=solvelin::FallbackOptions())
+        : BaseMinimization(f, max_iter, tol, lambda), solver(fallback) {}
+
+        // Values of many points in one call, the gradient and Hessian stencils are then evaluated in one call each
+        void set_batch(const Func_batch_s& batch){
+            batch_s = batch;
+        }
 
         Scalar compute_error(Vector& x) override {
             Scalar error = f(x);
+            count(stats.residual_evaluations);
             return error;
         }
 
         Vector compute_delta(Vector& x) override {
-            Matrix gp = numerical_deriv::JacobianApprox(f, x);
-            Matrix gpp = numerical_deriv::HessianApprox(f, x);
-            Vector delta = solvelin::cholesky::ldlt(gpp, -gp);
-            return delta;
+            Vector gp;
+            {
+                ScopedTimer timer(stats.jacobian_time);
+                if(batch_s){
+                    gp = numerical_deriv::GradientApproxBatch(batch_s, x);
+                    numerical_deriv::HessianApproxBatch(batch_s, x, H);
+                } else {
+                    gp = numerical_deriv::JacobianApprox(f, x);
+                    numerical_deriv::HessianApprox(f, x, H);
+                }
+            }
+            count(stats.jacobian_evaluations);
+            count(stats.hessian_evaluations);
+            record_gradient(gp);
+            ScopedTimer timer(stats.solve_time);
+            solver.compute(H);
+            count(solver);
+            auto delta = solver.solve(-gp);
+            return delta ? delta.x : Vector::Zero(x.size());
         }
     };    
 
     class GaussianNewton : public BaseMinimization<Func_v> {
     private:
         Vector residuals;
+
+        // state kept across calls to run() when warm starting
+        bool warm_start = false;
+        bool reuse_jacobian = false;
+        bool residuals_updated = false;
+        Vector x_residuals;
+        Matrix J;
+        Matrix JtJ;
+        const solvelin::FallbackOptions fallback;
+        solvelin::SymmetricSolver<Matrix> solver;
+        solvelin::MixedPrecisionSolver<float, Matrix> mixed;
+        bool mixed_precision = false;
+        bool use_mixed = false;
+        int sketch_ratio = 0;
+        std::optional<solvelin::randomized::SketchPreconditioner<Scalar>> sketch;
+        std::optional<solvelin::LeastSquaresSolver<Matrix>> selector;
+        solvelin::Tuning tuning;
+        std::optional<solvelin::LeastSquares> selection; // method of the current run, for Jacobians of this shape
+        Eigen::Index selection_rows = 0;
+        Eigen::Index selection_cols = 0;
+        bool factorized = false;
+
+        void factorize(){
+            factorized = true;
+            use_mixed = false;
+            sketch.reset();
+            if(selector){
+                if(!selection || J.rows()!=selection_rows || J.cols()!=selection_cols){
+                    selection = solvelin::select(J, tuning);
+                    selection_rows = J.rows();
+                    selection_cols = J.cols();
+                }
+                if(selector->compute(J, *selection)!=*selection){
+                    count(stats.fallbacks);
+                    selection = selector->method(); // keeps the method that worked for the next Jacobians
+                }
+                return;
+            }
+            if(sketch_ratio>0 && J.rows()>=static_cast<Eigen::Index>(sketch_ratio)*J.cols()){
+                sketch.emplace(J);
+                return;
+            }
+            JtJ.noalias() = J.transpose()*J;
+            use_mixed = mixed_precision && mixed.compute(JtJ)==solvelin::Status::Success;
+            if(!use_mixed){
+                solver.compute(JtJ);
+                count(solver);
+            }
+        }
+
+        Vector solve(){
+            if(selector){
+                const auto method = selector->method();
+                auto delta = selector->solve(-residuals);
+                if(selector->method()!=method) count(stats.fallbacks);
+                return delta ? delta.x : Vector::Zero(J.cols());
+            }
+            if(sketch){
+                Vector delta = sketch->initial_guess(-residuals);
+                if(solvelin::iterative::lsqr(J, -residuals, delta, *sketch, 1e-12, 100).converged && delta.allFinite())
+                    return delta;
+                // J is rank deficient, solve the normal equations instead
+                sketch.reset();
+                JtJ.noalias() = J.transpose()*J;
+                solver.compute(JtJ);
+                count(stats.fallbacks);
+            }
+            const Vector Jr = -J.transpose()*residuals;
+            if(use_mixed){
+                auto delta = mixed.solve(Jr);
+                if(delta) return delta.x;
+                solver.compute(JtJ);
+                count(solver);
+                use_mixed = false;
+            }
+            auto delta = solver.solve(Jr);
+            return delta ? delta.x : Vector::Zero(Jr.size());
+        }
+
     public:
-        GaussianNewton(const Func_v& f, const int max_iter=10000, const Scalar tol=1e-12, const Scalar lambda=1)
-        : BaseMinimization(f, max_iter, tol, lambda) {}
+        GaussianNewton(const Func_v& f, const int max_iter=10000, const Scalar tol=1e-12, const Scalar lambda=1,
+                       const solvelin::FallbackOptions& fallback=solvelin::FallbackOptions())
+        : BaseMinimization(f, max_iter, tol, lambda), fallback(fallback), solver(fallback) {}
+
+        // When enabled, the first iteration of each run() reuses the Jacobian and factorization of the previous run
+        void set_warm_start(const bool enable){
+            warm_start = enable;
+        }
+
+        // Factorizes J^T J in single precision and refines the steps in double, falling back to a double factorization
+        // when refinement does not converge
+        void set_mixed_precision(const bool enable){
+            mixed_precision = enable;
+            factorized = false;
+        }
+
+        // Solves the linearized problem on J with sketch-preconditioned LSQR instead of forming J^T J,
+        // when J has at least min_ratio times more rows than columns. 0 disables it.
+        void set_sketching(const int min_ratio){
+            sketch_ratio = min_ratio;
+            factorized = false;
+        }
+
+        // Solves the linearized problem with the method picked by solvelin::select() from the shape, density and
+        // conditioning of J, e.g. QR on J instead of J^T J when J is ill-conditioned. The method is picked from the
+        // first Jacobian of each run, again only when the shape of J changes, and replaced by the one that worked
+        // when it fails. It takes precedence over mixed precision and sketching. The tuning may come from
+        // solvelin::load_or_calibrate().
+        void set_solver_selection(const bool enable, const solvelin::Tuning& tuning=solvelin::Tuning()){
+            if(enable) selector.emplace(tuning, fallback);
+            else selector.reset();
+            this->tuning = tuning;
+            selection.reset();
+            factorized = false;
+        }
+
+        void reset(){
+            factorized = false;
+            residuals_updated = false;
+        }
+
+        // Replaces the given residual rows at the last evaluated x, so the next run() starting
+        // from the previous solution does not need to re-evaluate the residual function
+        void update_residuals(const std::vector<int>& rows, const Vector& values){
+            if(rows.size()!=static_cast<size_t>(values.size()))
+                throw std::invalid_argument("rows and values must have the same size!");
+            if(residuals.size()==0)
+                throw std::runtime_error("No residuals have been evaluated yet!");
+            for(const int row:rows)
+                if(row<0 || row>=residuals.size())
+                    throw std::invalid_argument("Residual row out of range!");
+            for(size_t i=0; i<rows.size(); ++i)
+                residuals(rows[i]) = values(i);
+            residuals_updated = true;
+        }
+
+        void begin_run(Vector& x) override {
+            reuse_jacobian = warm_start && factorized && J.cols()==x.size();
+            if(!reuse_jacobian) selection.reset();
+        }
+
+        void load_state(checkpoint::Reader&) override {
+            reuse_jacobian = false;
+            residuals_updated = false;
+            selection.reset();
+        }
             
+        Scalar compute_error(Vector& x) override {
+            if(!(residuals_updated && x.size()==x_residuals.size() && x==x_residuals)){
+                residuals = f(x);
+                x_residuals = x;
+                count(stats.residual_evaluations);
+            }
+            residuals_updated = false;
+            Scalar error = pow(residuals.norm(), 2);
+            return error;
+        }
+
+        Vector compute_delta(Vector& x) override {
+            const bool update = !reuse_jacobian || J.rows()!=residuals.size();
+            if(update) J = jacobian(x);
+            reuse_jacobian = false;
+            record_gradient(2*J.transpose()*residuals);
+
+            ScopedTimer timer(stats.solve_time);
+            if(update) factorize();
+            Vector delta = solve();
+            return delta;
+        }
+    };
+
+    // Variable projection (Golub-Pereyra) for separable least squares min ||basis(a)*c - y|| over the nonlinear
+    // parameters a and the linear coefficients c. The coefficients are eliminated by a least-squares solve in each
+    // residual evaluation, Gauss-Newton then iterates on a alone and its Jacobian has one column per nonlinear parameter.
+    class VariableProjection : public GaussianNewton {
+    private:
+        const Func_basis basis;
+        const Vector y;
+        const solvelin::LeastSquares method;
+
+        static Vector coefficients(const Matrix& Phi, const Vector& y, const solvelin::LeastSquares method){
+            if(Phi.rows()!=y.size())
+                throw std::invalid_argument("The basis must have as many rows as y!");
+            solvelin::LeastSquaresSolver<Matrix> solver;
+            solver.compute(Phi, method);
+            auto c = solver.solve(y);
+            return c ? c.x : Vector::Zero(Phi.cols());
+        }
+
+        // Residuals of the best fit of the coefficients for a given a
+        static Func_v projection(const Func_basis& basis, const Vector& y, const solvelin::LeastSquares method){
+            return [basis, y, method](const Vector& a) -> Vector {
+                const Matrix Phi = basis(a);
+                return Phi*coefficients(Phi, y, method) - y;
+            };
+        }
+
+    public:
+        VariableProjection(const Func_basis& basis, const Vector& y, const int max_iter=10000, const Scalar tol=1e-12,
+                           const Scalar lambda=1, const solvelin::LeastSquares method=solvelin::LeastSquares::HouseholderQR,
+                           const solvelin::FallbackOptions& fallback=solvelin::FallbackOptions())
+        : GaussianNewton(projection(basis, y, method), max_iter, tol, lambda, fallback), basis(basis), y(y), method(method) {}
+
+        // The residuals are the projected ones computed from the basis, a batch of them cannot be given
+        void set_batch(const Func_batch_v&) = delete;
+
+        // Linear coefficients c minimizing ||basis(a)*c - y||, to be called with the a found by run()
+        Vector linear_parameters(const Vector& a) const {
+            return coefficients(basis(a), y, method);
+        }
+    };
+
+    // Gauss-Newton on residuals produced in chunks, memory is O(n^2 + chunk*n) whatever the number of residuals
+    class ChunkedGaussianNewton : public BaseMinimization<Func_chunk> {
+    private:
+        const int num_chunks;
+        parallel::ThreadPool pool;
+        Matrix JtJ;
+        Vector Jtr;
+        solvelin::SymmetricSolver<Matrix> solver;
+
+    public:
+        ChunkedGaussianNewton(const Func_chunk& f, const int num_chunks, const int max_iter=10000, const Scalar tol=1e-12, 
+                              const Scalar lambda=1, const int threads=1,
+                              const solvelin::FallbackOptions& fallback=solvelin::FallbackOptions())
+        : BaseMinimization(f, max_iter, tol, lambda), num_chunks(num_chunks), pool(threads), solver(fallback) {}
+
+        // Every chunk is evaluated once per iteration: the error comes with the normal equations used by
+        // compute_delta, and the time of this pass is counted as Jacobian time
+        Scalar compute_error(Vector& x) override {
+            const Clock::time_point start = Clock::now();
+            const Scalar error = numerical_deriv::NormalEquationsApprox(f, num_chunks, x, JtJ, Jtr, &pool);
+            count(stats.residual_evaluations);
+            count(stats.jacobian_evaluations);
+            if constexpr (collect_stats){
+                const Clock::duration elapsed = Clock::now()-start;
+                stats.residual_time -= elapsed; // added back by the timer of the calling loop
+                stats.jacobian_time += elapsed;
+            }
+            return error;
+        }
+
+        Vector compute_delta(Vector& x) override {
+            record_gradient(2*Jtr);
+            ScopedTimer timer(stats.solve_time);
+            solver.compute(JtJ);
+            count(solver);
+            auto delta = solver.solve(-Jtr);
+            return delta ? delta.x : Vector::Zero(x.size());
+        }
+    };
+
+    // Gauss-Newton on a residual-block Problem using a sparse Jacobian and sparse normal equations
+    class SparseGaussianNewton : public BaseMinimization<Problem> {
+    private:
+        Vector residuals;
+        SparseMatrix J;
+        SparseMatrix JtJ;
+        Eigen::SimplicialLDLT<SparseMatrix> ldlt;
+        bool analyzed = false;
+        const solvelin::FallbackOptions fallback;
+        solvelin::SymmetricSolver<Matrix> dense;
+
+        bool factorize(const Scalar mu){
+            ldlt.setShift(mu);
+            ldlt.factorize(JtJ);
+            if(ldlt.info()!=Eigen::Success) return false;
+            const Vector D = ldlt.vectorD();
+            return D.size()==0 || D.minCoeff() > fallback.pivot_tolerance*D.cwiseAbs().maxCoeff();
+        }
+
+    public:
+        SparseGaussianNewton(const Problem& f, const int max_iter=10000, const Scalar tol=1e-12, const Scalar lambda=1,
+                             const solvelin::FallbackOptions& fallback=solvelin::FallbackOptions())
+        : BaseMinimization(f, max_iter, tol, lambda), fallback(fallback), dense(fallback) {}
+
         Scalar compute_error(Vector& x) override {
             residuals = f(x);
+            count(stats.residual_evaluations);
+            Scalar error = pow(residuals.norm(), 2);
+            return error;
+        }
+
+        Vector compute_delta(Vector& x) override {
+            {
+                ScopedTimer timer(stats.jacobian_time);
+                f.jacobian(x, J);
+            }
+            count(stats.jacobian_evaluations);
+            ScopedTimer timer(stats.solve_time);
+            JtJ = J.transpose()*J;
+            if(!analyzed){
+                ldlt.analyzePattern(JtJ);
+                analyzed = true;
+            }
+            Vector Jr = -J.transpose()*residuals;
+            record_gradient(2*Jr);
+            if(factorize(0)) return ldlt.solve(Jr);
+
+            // same chain as solvelin::SymmetricSolver, shifting the sparse factorization before going dense
+            count(stats.fallbacks);
+            if(fallback.regularize){
+                Scalar mu = fallback.regularization*std::max(Vector(JtJ.diagonal()).cwiseAbs().maxCoeff(), 1e-300);
+                for(int i=0; i<fallback.max_regularizations; ++i, mu *= fallback.growth)
+                    if(factorize(mu)) return ldlt.solve(Jr);
+            }
+            if(!fallback.cod) return Vector::Zero(x.size());
+            dense.compute(Matrix(JtJ));
+            auto delta = dense.solve(Jr);
+            return delta ? delta.x : Vector::Zero(x.size());
+        }
+    };
+
+    // Powell's dogleg trust-region method, J^T J is factorized once per Jacobian and reused when a step is rejected.
+    // When every retry is rejected x is left unchanged, the next iteration reuses its Jacobian and steps.
+    class Dogleg : public BaseMinimization<Func_v> {
+    private:
+        Vector residuals;
+        Vector x_trial;
+        Vector residuals_trial;
+        Vector x_jacobian; // x of J, the residuals and the steps below
+        Matrix J;
+        Matrix JtJ;
+        Vector h_sd;
+        Vector h_gn;
+        solvelin::SymmetricSolver<Matrix> solver;
+        const Scalar initial_radius;
+        Scalar radius;
+        const int max_retries;
+
+        static Vector dogleg_step(const Vector& h_gn, const Vector& h_sd, const Scalar radius){
+            if(h_gn.norm()<=radius) return h_gn;
+            const Scalar sd_norm = h_sd.norm();
+            if(sd_norm>=radius) return (radius/sd_norm)*h_sd;
+            const Vector d = h_gn-h_sd;
+            const Scalar c = h_sd.dot(d);
+            const Scalar dd = d.squaredNorm();
+            const Scalar beta = (-c + sqrt(c*c + dd*(radius*radius - sd_norm*sd_norm)))/dd;
+            return h_sd + beta*d;
+        }
+
+    public:
+        using BaseMinimization::set_speculation;
+
+        Dogleg(const Func_v& f, const int max_iter=10000, const Scalar tol=1e-12, const Scalar radius=1, const int max_retries=10)
+        : BaseMinimization(f, max_iter, tol, 1), initial_radius(radius), radius(radius), max_retries(max_retries) {}
+
+        void begin_run(Vector&) override {
+            radius = initial_radius;
+            x_jacobian.resize(0);
+        }
+
+        void save_state(checkpoint::Writer& out) const override {
+            out.put(radius);
+            out.put(x_trial);
+            out.put(residuals_trial);
+        }
+
+        void load_state(checkpoint::Reader& in) override {
+            radius = in.get<Scalar>();
+            in.get(x_trial);
+            in.get(residuals_trial);
+            x_jacobian.resize(0);
+        }
+
+        Scalar compute_error(Vector& x) override {
+            if(x_trial.size()==x.size() && x==x_trial){
+                residuals = residuals_trial;
+            } else if(!(x_jacobian.size()==x.size() && x==x_jacobian)){
+                residuals = f(x);
+                count(stats.residual_evaluations);
+            }
+            Scalar error = pow(residuals.norm(), 2);
+            return error;
+        }
+
+        Vector compute_delta(Vector& x) override {
+            if(!(x_jacobian.size()==x.size() && x==x_jacobian)){
+                J = jacobian(x);
+                x_jacobian = x;
+                const Vector g = J.transpose()*residuals;
+                record_gradient(2*g);
+                const Scalar Jg = (J*g).squaredNorm();
+                h_sd = Jg>0 ? Vector(-(g.squaredNorm()/Jg)*g) : Vector::Zero(x.size());
+                if(Jg>0){
+                    ScopedTimer timer(stats.solve_time);
+                    JtJ.noalias() = J.transpose()*J;
+                    solver.compute(JtJ);
+                    count(solver);
+                    auto gn = solver.solve(-g);
+                    h_gn = gn ? gn.x : h_sd;
+                }
+            }
+            if(h_sd.isZero(0)) return Vector::Zero(x.size());
+
+            // a rejected step halves the radius, each wave tries the next radii at once and keeps the best accepted step
+            const Scalar error = residuals.squaredNorm();
+            const Scalar min_radius = std::numeric_limits<Scalar>::epsilon()*(x.norm()+std::numeric_limits<Scalar>::epsilon());
+            const int width = speculative_width();
+            for(int i=0; i<max_retries && (i==0 || radius>min_radius);){
+                std::vector<Scalar> radii;
+                std::vector<Vector> steps;
+                std::vector<Vector> trials;
+                Scalar r = radius;
+                for(; static_cast<int>(radii.size())<width && i<max_retries && (i==0 || r>min_radius); ++i, r*=0.5){
+                    // the Gauss-Newton step stays the same while it fits in the radius
+                    if(width>1 && !steps.empty() && h_gn.norm()<=r) continue;
+                    radii.push_back(r);
+                    steps.push_back(dogleg_step(h_gn, h_sd, r));
+                    trials.push_back(x + steps.back());
+                }
+                const std::vector<Vector> residuals_trials = evaluate(trials);
+
+                int best = -1;
+                Scalar best_rho = 0;
+                Scalar best_error = error;
+                for(size_t k=0; k<steps.size(); ++k){
+                    const Scalar predicted = error - (residuals + J*steps[k]).squaredNorm();
+                    const Scalar trial_error = residuals_trials[k].squaredNorm();
+                    const Scalar rho = predicted>0 ? (error-trial_error)/predicted : -1;
+                    if(rho>0 && trial_error<best_error){
+                        best = k;
+                        best_rho = rho;
+                        best_error = trial_error;
+                    }
+                }
+                if(best<0){
+                    x_trial = trials.back();
+                    residuals_trial = residuals_trials.back();
+                    radius = r;
+                    continue;
+                }
+
+                x_trial = trials[best];
+                residuals_trial = residuals_trials[best];
+                radius = radii[best];
+                if(best_rho>0.75){
+                    radius = std::max(radius, 3*steps[best].norm());
+                } else if(best_rho<0.25){
+                    radius = 0.5*radius;
+                }
+                return steps[best];
+            }
+            return Vector::Zero(x.size());
+        }
+    };
+
+    enum CGUpdate {
+        FletcherReeves,
+        PolakRibierePlus
+    };
+
+    // Nonlinear conjugate gradient with a backtracking Armijo line search, restarted every `restart` iterations
+    // (every n iterations by default) or whenever the direction is not a descent direction or its line search fails.
+    // Only O(n) vectors and one residual vector are stored, the gradient is differenced column by column.
+    class ConjugateGradient : public BaseMinimization<Func_v> {
+    private:
+        Vector residuals;
+        Vector x_trial;
+        Vector residuals_trial;
+        Vector g_prev;
+        Vector d_prev;
+        int k = 0;
+        const CGUpdate update;
+        const int restart;
+
+        // Backtracks from the minimizer of the linearized residuals along the descent direction d until the Armijo
+        // condition holds, each wave tries the next halvings of alpha at once and keeps the lowest error meeting it.
+        // Returns 0 when it never holds.
+        Scalar line_search(const Vector& x, const Vector& g, const Vector& d){
+            // the gradient of ||r||^2 is 2*J^T*r
+            const Scalar slope = g.dot(d);
+            Scalar alpha;
+            {
+                ScopedTimer timer(stats.jacobian_time);
+                alpha = -slope/numerical_deriv::JacobianProductCentral(f, x, d).squaredNorm();
+            }
+            if(!(alpha>0) || !std::isfinite(alpha)) alpha = 1;
+
+            const Scalar error = residuals.squaredNorm();
+            const int width = speculative_width();
+            for(int i=0; i<50;){
+                std::vector<Scalar> alphas;
+                std::vector<Vector> trials;
+                for(; static_cast<int>(alphas.size())<width && i<50; ++i, alpha *= 0.5){
+                    alphas.push_back(alpha);
+                    trials.push_back(x + alpha*d);
+                }
+                const std::vector<Vector> residuals_trials = evaluate(trials);
+
+                int best = -1;
+                Scalar best_error = 0;
+                for(size_t j=0; j<alphas.size(); ++j){
+                    const Scalar trial_error = residuals_trials[j].squaredNorm();
+                    if(trial_error <= error + 1e-4*alphas[j]*2*slope && (best<0 || trial_error<best_error)){
+                        best = j;
+                        best_error = trial_error;
+                    }
+                }
+                if(best>=0){
+                    x_trial = trials[best];
+                    residuals_trial = residuals_trials[best];
+                    return alphas[best];
+                }
+            }
+            return 0;
+        }
+
+    public:
+        using BaseMinimization::set_speculation;
+
+        ConjugateGradient(const Func_v& f, const int max_iter=10000, const Scalar tol=1e-12, 
+                          const CGUpdate update=PolakRibierePlus, const int restart=0)
+        : BaseMinimization(f, max_iter, tol, 1), update(update), restart(restart) {}
+
+        void begin_run(Vector&) override {
+            g_prev.resize(0);
+            k = 0;
+        }
+
+        void save_state(checkpoint::Writer& out) const override {
+            out.put(k);
+            out.put(g_prev);
+            out.put(d_prev);
+            out.put(x_trial);
+            out.put(residuals_trial);
+        }
+
+        void load_state(checkpoint::Reader& in) override {
+            k = in.get<int>();
+            in.get(g_prev);
+            in.get(d_prev);
+            in.get(x_trial);
+            in.get(residuals_trial);
+        }
+
+        Scalar compute_error(Vector& x) override {
+            if(x_trial.size()==x.size() && x==x_trial){
+                residuals = residuals_trial;
+            } else {
+                residuals = f(x);
+                count(stats.residual_evaluations);
+            }
             Scalar error = pow(residuals.norm(), 2);
             return error;
         }
 
         Vector compute_delta(Vector& x) override {
-            Matrix J = numerical_deriv::JacobianApproxCentral(f, x);
-            Matrix JtJ = J.transpose()*J;
-            Matrix Jr = -J.transpose()*residuals;
-            Vector delta;
-            try{
-                delta = solvelin::cholesky::ldlt(JtJ, Jr);
-            } catch (const std::exception& e) {
-                std::cout << "using fullPiv" << std::endl;
-                delta = solvelin::lu::fullPiv(JtJ, Jr);
+            const Vector g = gradient(x, residuals);
+            record_gradient(2*g);
+
+            const int period = restart>0 ? restart : x.size();
+            Vector d = -g;
+            bool conjugate = false;
+            if(g_prev.size()==g.size() && k%period!=0){
+                const Scalar gg_prev = g_prev.squaredNorm();
+                Scalar beta = 0;
+                if(update==FletcherReeves){
+                    beta = g.squaredNorm()/gg_prev;
+                } else {
+                    beta = std::max(Scalar(0), g.dot(g-g_prev)/gg_prev);
+                }
+                d += beta*d_prev;
+                conjugate = beta!=0;
+                if(d.dot(g)>=0){
+                    d = -g;
+                    conjugate = false;
+                }
             }
+            k++;
+            if(g.dot(d)>=0) return Vector::Zero(x.size());
+
+            Scalar alpha = line_search(x, g, d);
+            if(alpha==0 && conjugate){
+                d = -g;
+                alpha = line_search(x, g, d);
+            }
+            if(alpha==0){
+                // no decrease along -g either, stay at x and restart from -g at the next iteration
+                x_trial = x;
+                residuals_trial = residuals;
+                g_prev.resize(0);
+                return Vector::Zero(x.size());
+            }
+
+            g_prev = g;
+            d_prev = d;
+            return alpha*d;
+        }
+    };
+
+    // Nesterov accelerated gradient, the step size is `lambda` and the velocity is reset whenever the error increases
+    // or the step points uphill. Like ConjugateGradient it stores O(n) vectors and differences the gradient column
+    // by column.
+    class NesterovGradient : public BaseMinimization<Func_v> {
+    private:
+        Vector residuals;
+        Vector velocity;
+        Scalar prev_error = std::numeric_limits<Scalar>::max();
+        const Scalar momentum;
+
+    public:
+        NesterovGradient(const Func_v& f, const int max_iter=10000, const Scalar tol=1e-12, const Scalar lambda=1, 
+                         const Scalar momentum=0.9)
+        : BaseMinimization(f, max_iter, tol, lambda), momentum(momentum) {}
+
+        void begin_run(Vector& x) override {
+            velocity = Vector::Zero(x.size());
+            prev_error = std::numeric_limits<Scalar>::max();
+        }
+
+        void save_state(checkpoint::Writer& out) const override {
+            out.put(prev_error);
+            out.put(velocity);
+        }
+
+        void load_state(checkpoint::Reader& in) override {
+            prev_error = in.get<Scalar>();
+            in.get(velocity);
+        }
+
+        Scalar compute_error(Vector& x) override {
+            residuals = f(x);
+            count(stats.residual_evaluations);
+            Scalar error = pow(residuals.norm(), 2);
+            if(error>prev_error) velocity.setZero();
+            prev_error = error;
+            return error;
+        }
+
+        Vector compute_delta(Vector& x) override {
+            Vector y = x + momentum*velocity;
+            Vector r_y = evaluate(y);
+            Vector g = gradient(y, r_y);
+            record_gradient(2*g);
+            Vector delta = momentum*velocity/lambda - g;
+            velocity = lambda*delta;
+            // gradient restart: drop the momentum once it points uphill
+            if(g.dot(delta)>0) velocity.setZero();
             return delta;
         }
     };
@@ -115,17 +1009,254 @@ namespace optim {
 
         Scalar compute_error(Vector& x) override {
             residuals = f(x);
+            count(stats.residual_evaluations);
             Scalar error = pow(residuals.norm(), 2);
             return error;
         }
 
         Vector compute_delta(Vector& x) override {
-            Matrix J = numerical_deriv::JacobianApproxCentral(f, x);
+            Matrix J = jacobian(x);
             Vector delta = -J.transpose()*residuals;
+            record_gradient(2*delta);
             return delta;
         }
     };    
 
+    // Multiplier of the learning rate at a given step, starting from 0
+    using Schedule = std::function< Scalar(const int step) >;
+
+namespace schedule {
+
+    inline
+    Schedule constant(){
+        return [](const int){ return Scalar(1); };
+    }
+
+    // Multiplies the rate by factor every `every` steps
+    inline
+    Schedule step_decay(const Scalar factor, const int every){
+        if(every<=0)
+            throw std::invalid_argument("The decay period must be positive!");
+        return [factor, every](const int step){ return pow(factor, step/every); };
+    }
+
+    inline
+    Schedule inverse_time(const Scalar decay){
+        return [decay](const int step){ return 1/(1+decay*step); };
+    }
+
+    // Cosine annealing from 1 down to min_factor over `steps` steps, min_factor afterwards
+    inline
+    Schedule cosine(const int steps, const Scalar min_factor=0){
+        if(steps<=0)
+            throw std::invalid_argument("The number of annealing steps must be positive!");
+        return [steps, min_factor](const int step){
+            const Scalar progress = std::min(Scalar(step)/steps, Scalar(1));
+            return min_factor + (1-min_factor)*0.5*(1+cos(std::numbers::pi*progress));
+        };
+    }
+
+} // end namespace schedule
+
+    // Draws batches of residual rows without replacement, reshuffling at each epoch. The order of an epoch only
+    // depends on the seed and the epoch number, so a sampler is restored from its cursor alone.
+    class BatchSampler {
+    private:
+        const int num_residuals;
+        const int batch_size;
+        const uint64_t seed;
+        std::vector<int> order;
+        int epoch_ = -1;
+        int position_ = 0;
+
+        void shuffle(){
+            order.resize(num_residuals);
+            std::iota(order.begin(), order.end(), 0);
+            std::shuffle(order.begin(), order.end(), std::mt19937_64(seed+epoch_));
+        }
+
+    public:
+        BatchSampler(const int num_residuals, const int batch_size, const uint64_t seed=0)
+        : num_residuals(num_residuals), batch_size(batch_size), seed(seed) {
+            if(num_residuals<=0 || batch_size<=0)
+                throw std::invalid_argument("The number of residuals and the batch size must be positive!");
+        }
+
+        // Rows of the next batch in increasing order, the last batch of an epoch may be smaller
+        std::vector<int> next(){
+            if(epoch_<0 || position_>=num_residuals) seek(epoch_+1, 0);
+            const int end = std::min(position_+batch_size, num_residuals);
+            std::vector<int> rows(order.begin()+position_, order.begin()+end);
+            std::sort(rows.begin(), rows.end());
+            position_ = end;
+            return rows;
+        }
+
+        void seek(const int epoch, const int position){
+            if(epoch!=epoch_){
+                epoch_ = epoch;
+                if(epoch_>=0) shuffle();
+            }
+            position_ = position;
+        }
+
+        int epoch() const {
+            return epoch_;
+        }
+
+        int position() const {
+            return position_;
+        }
+    };
+
+    enum StochasticUpdate {
+        Momentum,
+        Adam
+    };
+
+    // Mini-batch gradient descent on an indexed residual function, each iteration evaluates the residuals and the
+    // central difference Jacobian of one batch of rows only. The reported error is the full error over all residuals,
+    // evaluated once per epoch by default (see set_evaluation_period) and held in between: the error of a single
+    // batch is too noisy to decide termination or the best iterate. `lambda` is the base learning rate, multiplied
+    // by the schedule. While a batch is processed, the rows of the next one are drawn and handed to the optional
+    // prefetch function on a background thread, e.g. to page in their data. beta1 is the momentum of both updates,
+    // beta2 the decay of the second moment of Adam.
+    class StochasticGradientDescent : public BaseMinimization<Func_indexed> {
+    private:
+        const int num_residuals;
+        const StochasticUpdate update;
+        const Scalar beta1;
+        const Scalar beta2;
+        const Scalar epsilon = 1e-8;
+        Schedule learning_rate = schedule::constant();
+        std::function< void(const std::vector<int>& rows) > prefetch;
+        std::vector<int> all_rows;
+        int evaluation_period;
+
+        BatchSampler sampler;
+        std::vector<int> rows;
+        std::vector<int> next_rows;
+        int next_epoch = 0;
+        int next_position = 0;
+        std::unique_ptr<parallel::BackgroundWorker> prefetcher; // destroyed first, its job reads next_rows
+        Vector residuals;
+        Scalar full_error = std::numeric_limits<Scalar>::quiet_NaN();
+        Vector velocity;   // momentum, or first moment of Adam
+        Vector moment2;
+        int step = 0;
+
+        void draw_next(){
+            next_epoch = sampler.epoch();
+            next_position = sampler.position();
+            next_rows = sampler.next();
+            if(prefetcher) prefetcher->submit([this]{ prefetch(next_rows); });
+        }
+
+        void restart_sampler(const int epoch, const int position, const int size){
+            if(prefetcher){
+                try {
+                    prefetcher->wait();
+                } catch (...) {} // the batch of the previous run is dropped
+            }
+            sampler.seek(epoch, position);
+            draw_next();
+            velocity = Vector::Zero(size);
+            moment2 = Vector::Zero(size);
+        }
+
+    public:
+        StochasticGradientDescent(const Func_indexed& f, const int num_residuals, const int batch_size, 
+                                  const int max_iter=10000, const Scalar tol=1e-12, const Scalar lambda=1e-3,
+                                  const StochasticUpdate update=Adam, const Scalar beta1=0.9, const Scalar beta2=0.999,
+                                  const uint64_t seed=0)
+        : BaseMinimization(f, max_iter, tol, lambda), num_residuals(num_residuals), update(update), 
+          beta1(beta1), beta2(beta2), all_rows(std::max(num_residuals, 0)),
+          evaluation_period(std::max((num_residuals+batch_size-1)/std::max(batch_size, 1), 1)),
+          sampler(num_residuals, batch_size, seed) {
+            std::iota(all_rows.begin(), all_rows.end(), 0);
+        }
+
+        void set_schedule(const Schedule& schedule){
+            learning_rate = schedule;
+        }
+
+        // The prefetch function runs on one thread owned by the optimizer, a call at a time
+        void set_prefetch(const std::function< void(const std::vector<int>& rows) >& prefetch){
+            prefetcher.reset();
+            this->prefetch = prefetch;
+            if(prefetch) prefetcher = std::make_unique<parallel::BackgroundWorker>();
+        }
+
+        // Evaluates the error on all residuals every `iterations` iterations, once per epoch by default. This error
+        // decides termination and the best iterate, shorter periods react sooner at the cost of more evaluations.
+        void set_evaluation_period(const int iterations){
+            if(iterations<=0)
+                throw std::invalid_argument("The evaluation period must be positive!");
+            evaluation_period = iterations;
+        }
+
+        void begin_run(Vector& x) override {
+            restart_sampler(-1, 0, x.size());
+            step = 0;
+            full_error = std::numeric_limits<Scalar>::quiet_NaN();
+        }
+
+        void save_state(checkpoint::Writer& out) const override {
+            out.put(next_epoch);
+            out.put(next_position);
+            out.put(step);
+            out.put(full_error);
+            out.put(velocity);
+            out.put(moment2);
+        }
+
+        void load_state(checkpoint::Reader& in) override {
+            const int epoch = in.get<int>();
+            const int position = in.get<int>();
+            restart_sampler(epoch, position, 0);
+            step = in.get<int>();
+            full_error = in.get<Scalar>();
+            in.get(velocity);
+            in.get(moment2);
+        }
+
+        Scalar compute_error(Vector& x) override {
+            if(prefetcher) prefetcher->wait();
+            rows = std::move(next_rows);
+            draw_next();
+            residuals = f(x, rows);
+            count(stats.residual_evaluations);
+            if(step%evaluation_period==0){
+                full_error = pow(f(x, all_rows).norm(), 2);
+                count(stats.residual_evaluations);
+            }
+            return full_error;
+        }
+
+        Vector compute_delta(Vector& x) override {
+            Matrix J;
+            {
+                ScopedTimer timer(stats.jacobian_time);
+                Func_v func_batch = [&](const Vector& x_){ return f(x_, rows); };
+                J = numerical_deriv::JacobianApproxCentral(func_batch, x);
+            }
+            count(stats.jacobian_evaluations);
+            const Vector g = (J.transpose()*residuals)*(Scalar(num_residuals)/rows.size());
+            record_gradient(2*g);
+
+            const Scalar rate = learning_rate(step++);
+            if(update==Momentum){
+                velocity = beta1*velocity + g;
+                return -rate*velocity;
+            }
+            velocity = beta1*velocity + (1-beta1)*g;
+            moment2 = beta2*moment2 + (1-beta2)*g.cwiseAbs2();
+            const Vector m_hat = velocity/(1-pow(beta1, step));
+            const Vector v_hat = moment2/(1-pow(beta2, step));
+            return -rate*(m_hat.array()/(v_hat.array().sqrt()+epsilon)).matrix();
+        }
+    };
+
 } // end namespace optim
 
 } // end namespace non_lin_optim
\ No newline at end of file
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "trace.h"
+
+namespace non_lin_optim {
+
+namespace parallel {
+
+    using Task = std::function< void(const int worker, const int i) >;
+
+    // Fixed set of worker threads, the calling thread takes part in every parallel_for as worker 0
+    class ThreadPool {
+    private:
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::mutex submit;
+        std::condition_variable wake;
+        std::condition_variable done;
+
+        const Task* task = nullptr;
+        int task_size = 0;
+        std::atomic<int> next{0};
+        int active = 0;
+        size_t generation = 0;
+        bool stopping = false;
+        std::exception_ptr error;
+
+        static bool& inside_task(){
+            thread_local bool inside = false;
+            return inside;
+        }
+
+        void work(const int worker, const Task& f, const int n){
+            inside_task() = true;
+            for(int i=next++; i<n; i=next++){
+                try {
+                    f(worker, i);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if(!error) error = std::current_exception();
+                    next = n;
+                }
+            }
+            inside_task() = false;
+        }
+
+        void loop(const int worker){
+            NON_LIN_OPTIM_TRACE_THREAD_NAME("worker " + std::to_string(worker));
+            size_t seen = 0;
+            std::unique_lock<std::mutex> lock(mutex);
+            while(true){
+                wake.wait(lock, [&]{ return stopping || generation!=seen; });
+                if(stopping) return;
+                seen = generation;
+                const Task* f = task;
+                const int n = task_size;
+                lock.unlock();
+                work(worker, *f, n);
+                lock.lock();
+                if(--active==0) done.notify_one();
+            }
+        }
+
+    public:
+        explicit ThreadPool(const int threads=std::thread::hardware_concurrency()){
+            for(int i=1; i<std::max(threads, 1); ++i)
+                workers.emplace_back([this, i]{ loop(i); });
+        }
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        ~ThreadPool(){
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wake.notify_all();
+            for(auto& worker:workers)
+                worker.join();
+        }
+
+        int size() const {
+            return static_cast<int>(workers.size())+1;
+        }
+
+        // Calls f(worker, i) for every i in [0,n), nested calls from inside a task run serially
+        void parallel_for(const int n, const Task& f){
+            if(workers.empty() || n<=1 || inside_task()){
+                for(int i=0; i<n; ++i)
+                    f(0, i);
+                return;
+            }
+
+            std::lock_guard<std::mutex> guard(submit);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                task = &f;
+                task_size = n;
+                next = 0;
+                active = static_cast<int>(workers.size());
+                error = nullptr;
+                ++generation;
+            }
+            wake.notify_all();
+            work(0, f, n);
+
+            std::unique_lock<std::mutex> lock(mutex);
+            done.wait(lock, [&]{ return active==0; });
+            task = nullptr;
+            if(error) std::rethrow_exception(error);
+        }
+    };
+
+    // One persistent thread running the submitted jobs one after the other, while the caller goes on
+    class BackgroundWorker {
+    private:
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::function< void() > job;
+        bool busy = false;
+        bool stopping = false;
+        std::exception_ptr error;
+        std::thread thread;
+
+        void loop(){
+            NON_LIN_OPTIM_TRACE_THREAD_NAME("background worker");
+            std::unique_lock<std::mutex> lock(mutex);
+            while(true){
+                cv.wait(lock, [&]{ return job || stopping; });
+                if(!job) return;
+                const std::function< void() > f = std::move(job);
+                job = nullptr;
+                lock.unlock();
+                std::exception_ptr failure;
+                try {
+                    f();
+                } catch (...) {
+                    failure = std::current_exception();
+                }
+                lock.lock();
+                if(failure) error = failure;
+                busy = false;
+                cv.notify_all();
+            }
+        }
+
+    public:
+        BackgroundWorker(){
+            thread = std::thread([this]{ loop(); });
+        }
+
+        BackgroundWorker(const BackgroundWorker&) = delete;
+        BackgroundWorker& operator=(const BackgroundWorker&) = delete;
+
+        // Runs the pending job before returning
+        ~BackgroundWorker(){
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            cv.notify_all();
+            thread.join();
+        }
+
+        // Waits for the previous job, rethrowing its exception, and queues f
+        void submit(std::function< void() > f){
+            wait();
+            std::lock_guard<std::mutex> lock(mutex);
+            job = std::move(f);
+            busy = true;
+            cv.notify_all();
+        }
+
+        // Waits until the submitted job has run, rethrows its exception
+        void wait(){
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&]{ return !busy; });
+            if(error) std::rethrow_exception(std::exchange(error, nullptr));
+        }
+    };
+
+    inline
+    int num_workers(const ThreadPool* pool){
+        return pool ? pool->size() : 1;
+    }
+
+    inline
+    void parallel_for(ThreadPool* pool, const int n, const Task& f){
+        if(pool){
+            pool->parallel_for(n, f);
+        } else {
+            for(int i=0; i<n; ++i)
+                f(0, i);
+        }
+    }
+
+} // end namespace parallel
+
+} // end namespace non_lin_optim
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include "types.h"
+#include "numerical_deriv.h"
+#include "parallel.h"
+#include "trace.h"
+
+namespace non_lin_optim {
+
+    // Least-squares problem built from many small residual blocks, each depending on a few parameter blocks.
+    // Residual block functions receive the concatenation of their parameter blocks and may be called concurrently.
+    class Problem {
+    private:
+        struct ResidualBlock {
+            Func_v func;
+            std::vector<int> parameter_blocks;
+            int size;
+            int row;
+            int num_parameters;
+            int nnz_offset;
+        };
+
+        std::vector<int> block_sizes;
+        std::vector<int> block_offsets;
+        std::vector<ResidualBlock> residual_blocks;
+        int num_parameters_ = 0;
+        int num_residuals_ = 0;
+        int nnz = 0;
+        std::shared_ptr<parallel::ThreadPool> pool;
+
+        Vector gather(const Vector& x, const ResidualBlock& block) const {
+            Vector p(block.num_parameters);
+            int offset = 0;
+            for(int b:block.parameter_blocks){
+                p.segment(offset, block_sizes[b]) = x.segment(block_offsets[b], block_sizes[b]);
+                offset += block_sizes[b];
+            }
+            return p;
+        }
+
+        template<typename F>
+        void for_each_block(F&& f) const {
+            pool->parallel_for(residual_blocks.size(), [&](const int, const int i){
+                NON_LIN_OPTIM_TRACE_SCOPE_ARG("problem", "residual block", "block", i);
+                f(residual_blocks[i]);
+            });
+        }
+
+        Matrix block_jacobian(const Vector& x, const ResidualBlock& block, const Scalar step) const {
+            Vector p = gather(x, block);
+            Matrix J = numerical_deriv::JacobianApproxCentral(block.func, p, step);
+            if(J.rows()!=block.size)
+                throw std::runtime_error("Residual block returned a wrong number of residuals!");
+            return J;
+        }
+
+    public:
+        explicit Problem(const int threads=1)
+        : pool(std::make_shared<parallel::ThreadPool>(threads)) {}
+
+        int add_parameter_block(const int size){
+            if(size<=0)
+                throw std::invalid_argument("Parameter block size must be positive!");
+            block_sizes.push_back(size);
+            block_offsets.push_back(num_parameters_);
+            num_parameters_ += size;
+            return block_sizes.size()-1;
+        }
+
+        int add_residual_block(const int size, const Func_v& func, const std::vector<int>& parameter_blocks){
+            if(size<=0)
+                throw std::invalid_argument("Residual block size must be positive!");
+            int num_parameters = 0;
+            for(size_t i=0; i<parameter_blocks.size(); ++i){
+                const int b = parameter_blocks[i];
+                if(b<0 || b>=static_cast<int>(block_sizes.size()))
+                    throw std::invalid_argument("Unknown parameter block!");
+                for(size_t j=0; j<i; ++j)
+                    if(parameter_blocks[j]==b)
+                        throw std::invalid_argument("Parameter block used twice by the same residual block!");
+                num_parameters += block_sizes[b];
+            }
+            residual_blocks.push_back({func, parameter_blocks, size, num_residuals_, num_parameters, nnz});
+            num_residuals_ += size;
+            nnz += size*num_parameters;
+            return residual_blocks.size()-1;
+        }
+
+        int num_parameters() const {
+            return num_parameters_;
+        }
+
+        int num_residuals() const {
+            return num_residuals_;
+        }
+
+        int num_residual_blocks() const {
+            return residual_blocks.size();
+        }
+
+        Vector operator()(const Vector& x) const {
+            NON_LIN_OPTIM_TRACE_SCOPE_ARG("problem", "residuals", "blocks", residual_blocks.size());
+            Vector residuals(num_residuals_);
+            for_each_block([&](const ResidualBlock& block){
+                Vector r = block.func(gather(x, block));
+                if(r.size()!=block.size)
+                    throw std::runtime_error("Residual block returned a wrong number of residuals!");
+                residuals.segment(block.row, block.size) = r;
+            });
+            return residuals;
+        }
+
+        void jacobian(const Vector& x, Matrix& J, const Scalar step=1e-6) const {
+            NON_LIN_OPTIM_TRACE_SCOPE_ARG("problem", "jacobian", "blocks", residual_blocks.size());
+            J.setZero(num_residuals_, num_parameters_);
+            for_each_block([&](const ResidualBlock& block){
+                Matrix Jb = block_jacobian(x, block, step);
+                int col = 0;
+                for(int b:block.parameter_blocks){
+                    J.block(block.row, block_offsets[b], block.size, block_sizes[b]) = Jb.middleCols(col, block_sizes[b]);
+                    col += block_sizes[b];
+                }
+            });
+        }
+
+        void jacobian(const Vector& x, SparseMatrix& J, const Scalar step=1e-6) const {
+            NON_LIN_OPTIM_TRACE_SCOPE_ARG("problem", "sparse jacobian", "blocks", residual_blocks.size());
+            std::vector<Eigen::Triplet<Scalar>> triplets(nnz);
+            for_each_block([&](const ResidualBlock& block){
+                Matrix Jb = block_jacobian(x, block, step);
+                int t = block.nnz_offset;
+                int col = 0;
+                for(int b:block.parameter_blocks){
+                    for(int j=0; j<block_sizes[b]; ++j)
+                        for(int i=0; i<block.size; ++i)
+                            triplets[t++] = Eigen::Triplet<Scalar>(block.row+i, block_offsets[b]+j, Jb(i, col+j));
+                    col += block_sizes[b];
+                }
+            });
+            J.resize(num_residuals_, num_parameters_);
+            J.setFromTriplets(triplets.begin(), triplets.end());
+        }
+    };
+
+} // end namespace non_lin_optim
@@ -1,7 +1,22 @@
 #pragma once
 
 #include <Eigen/Dense>
+#include <Eigen/Sparse>
+#include <Eigen/IterativeLinearSolvers>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <optional>
+#include <random>
 #include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "trace.h"
 
 #define MatrixTT Eigen::Matrix<typename Eigen::ScalarBinaryOpTraits<typename T::Scalar, typename T::Scalar>::ReturnType,\
                                T::RowsAtCompileTime,\
@@ -20,8 +35,113 @@ namespace solvelin {
         return A.inverse()*b;
     }
 
+    // ||A-A^T|| <= prec*||A|| as A.isApprox(A.transpose()), in a single pass without forming the transpose
+    template<typename T>
+    bool is_symmetric(const Eigen::MatrixBase<T>& A, 
+                      const typename T::RealScalar prec=Eigen::NumTraits<typename T::Scalar>::dummy_precision()){
+        if(A.rows()!=A.cols()) return false;
+        typename T::RealScalar diff = 0;
+        typename T::RealScalar norm = 0;
+        for(Eigen::Index j=0; j<A.cols(); ++j){
+            norm += Eigen::numext::abs2(A(j,j));
+            for(Eigen::Index i=0; i<j; ++i){
+                diff += Eigen::numext::abs2(A(i,j)-A(j,i));
+                norm += Eigen::numext::abs2(A(i,j)) + Eigen::numext::abs2(A(j,i));
+            }
+        }
+        return 2*diff <= prec*prec*norm;
+    }
+
+    enum class Status {
+        Success,
+        NotSquare,
+        NotSymmetric,
+        NotPositiveDefinite,
+        Singular
+    };
+
+    // Solution or the reason it could not be computed, returned by the non-throwing solvers
+    template<typename X>
+    struct Result {
+        X x;
+        Status status = Status::Success;
+
+        explicit operator bool() const {
+            return status==Status::Success;
+        }
+    };
+
+    // Decomposition computed in place on a caller-owned matrix, whose content is replaced by the factors.
+    // Solving right-hand sides and refactor(), after new values of the same shape were written to the
+    // matrix, do not allocate.
+    template<typename MatrixType, typename Decomposition>
+    class Factorization {
+    private:
+        Eigen::Ref<MatrixType> A;
+        Decomposition decomposition;
+
+        static MatrixType& checked(MatrixType& A, const bool check_symmetry){
+            if(check_symmetry && !is_symmetric(A))
+                throw std::invalid_argument("Matrix A is not symmetric!");
+            return A;
+        }
+
+    public:
+        explicit Factorization(MatrixType& A, const bool check_symmetry=false)
+        : A(checked(A, check_symmetry)), decomposition(this->A) {}
+
+        void refactor(const bool check_symmetry=false){
+            if(check_symmetry && !is_symmetric(A))
+                throw std::invalid_argument("Matrix A is not symmetric!");
+            decomposition.compute(A);
+        }
+
+        bool bound_to(const MatrixType& B) const {
+            return A.data()==B.data() && A.rows()==B.rows() && A.cols()==B.cols();
+        }
+
+        // Refactors in place, binding a new factorization only when A was reallocated or reshaped
+        static Factorization& compute(std::optional<Factorization>& factorization, MatrixType& A, const bool check_symmetry=false){
+            NON_LIN_OPTIM_TRACE_SCOPE_ARG("solvelin", "factorize", "n", A.rows());
+            if(factorization && factorization->bound_to(A)){
+                factorization->refactor(check_symmetry);
+            } else {
+                factorization.emplace(A, check_symmetry);
+            }
+            return *factorization;
+        }
+
+        Eigen::ComputationInfo info() const {
+            if constexpr (requires(const Decomposition& d){ d.info(); }){
+                return decomposition.info();
+            } else {
+                return Eigen::Success;
+            }
+        }
+
+        template<typename U>
+        typename U::PlainObject solve(const Eigen::MatrixBase<U>& b) const {
+            return decomposition.solve(b);
+        }
+
+        template<typename U, typename X>
+        void solve(const Eigen::MatrixBase<U>& b, Eigen::PlainObjectBase<X>& x) const {
+            x = decomposition.solve(b);
+        }
+
+        const Decomposition& decomposed() const {
+            return decomposition;
+        }
+    };
+
 namespace lu {
 
+    template<typename MatrixType=Eigen::MatrixXd>
+    using PartialPiv = Factorization<MatrixType, Eigen::PartialPivLU<Eigen::Ref<MatrixType>>>;
+
+    template<typename MatrixType=Eigen::MatrixXd>
+    using FullPiv = Factorization<MatrixType, Eigen::FullPivLU<Eigen::Ref<MatrixType>>>;
+
     template<typename T, typename U>
     MatrixTU fullPiv(const Eigen::MatrixBase<T>& A, const Eigen::MatrixBase<U>& b){
         Eigen::FullPivLU<T> lu(A);
@@ -32,6 +152,15 @@ namespace lu {
 
 namespace qr {
 
+    template<typename MatrixType=Eigen::MatrixXd>
+    using HouseholderQr = Factorization<MatrixType, Eigen::HouseholderQR<Eigen::Ref<MatrixType>>>;
+
+    template<typename MatrixType=Eigen::MatrixXd>
+    using ColPivHouseholderQr = Factorization<MatrixType, Eigen::ColPivHouseholderQR<Eigen::Ref<MatrixType>>>;
+
+    template<typename MatrixType=Eigen::MatrixXd>
+    using CompleteOrthogonalDecomposition = Factorization<MatrixType, Eigen::CompleteOrthogonalDecomposition<Eigen::Ref<MatrixType>>>;
+
     template<typename T, typename U>
     MatrixTU householderQr(const Eigen::MatrixBase<T>& A, const Eigen::MatrixBase<U>& b){
         return A.householderQr().solve(b);
@@ -56,28 +185,47 @@ namespace qr {
 
 namespace cholesky {
 
+    template<typename MatrixType=Eigen::MatrixXd>
+    using LLT = Factorization<MatrixType, Eigen::LLT<Eigen::Ref<MatrixType>>>;
+
+    template<typename MatrixType=Eigen::MatrixXd>
+    using LDLT = Factorization<MatrixType, Eigen::LDLT<Eigen::Ref<MatrixType>>>;
+
     template<typename T, typename U>
-    MatrixTU llt(const Eigen::MatrixBase<T>& A, const Eigen::MatrixBase<U>& b){
-        if(A.rows()!=A.cols()){
-            throw std::invalid_argument("A is not square!");
-        }
+    Result<MatrixTU> try_llt(const Eigen::MatrixBase<T>& A, const Eigen::MatrixBase<U>& b, const bool check_symmetry=true){
+        if(A.rows()!=A.cols()) return {{}, Status::NotSquare};
+        if(check_symmetry && !is_symmetric(A)) return {{}, Status::NotSymmetric};
         Eigen::LLT<T> llt(A);
-        if(!A.isApprox(A.transpose()) || llt.info() == Eigen::NumericalIssue){
-            throw std::runtime_error("Matrix A appears not to be positive definite!");
-        }
-        return llt.solve(b);
+        if(llt.info() == Eigen::NumericalIssue) return {{}, Status::NotPositiveDefinite};
+        return {llt.solve(b)};
     }
 
     template<typename T, typename U>
-    MatrixTU ldlt(const Eigen::MatrixBase<T>& A, const Eigen::MatrixBase<U>& b){
-        if(A.rows()!=A.cols()){
-            throw std::invalid_argument("A is not square!");
-        }
+    Result<MatrixTU> try_ldlt(const Eigen::MatrixBase<T>& A, const Eigen::MatrixBase<U>& b, const bool check_symmetry=true){
+        if(A.rows()!=A.cols()) return {{}, Status::NotSquare};
+        if(check_symmetry && !is_symmetric(A)) return {{}, Status::NotSymmetric};
         Eigen::LDLT<T> ldlt(A);
-        if(!A.isApprox(A.transpose()) || ldlt.info() == Eigen::NumericalIssue){
+        if(ldlt.info() == Eigen::NumericalIssue) return {{}, Status::NotPositiveDefinite};
+        return {ldlt.solve(b)};
+    }
+
+    template<typename X>
+    X value_or_throw(Result<X>&& result){
+        if(result.status==Status::NotSquare)
+            throw std::invalid_argument("A is not square!");
+        if(!result)
             throw std::runtime_error("Matrix A appears not to be positive definite!");
-        }
-        return ldlt.solve(b);
+        return std::move(result.x);
+    }
+
+    template<typename T, typename U>
+    MatrixTU llt(const Eigen::MatrixBase<T>& A, const Eigen::MatrixBase<U>& b, const bool check_symmetry=true){
+        return value_or_throw(try_llt(A, b, check_symmetry));
+    }
+
+    template<typename T, typename U>
+    MatrixTU ldlt(const Eigen::MatrixBase<T>& A, const Eigen::MatrixBase<U>& b, const bool check_symmetry=true){
+        return value_or_throw(try_ldlt(A, b, check_symmetry));
     }
 
 } // end namesapce cholesky
@@ -96,4 +244,913 @@ namespace svd {
 
 } // end namespace svd
 
+    enum class Method {
+        LDLT,
+        Regularized,
+        COD
+    };
+
+    struct FallbackOptions {
+        bool regularize = true;
+        int max_regularizations = 4;
+        double regularization = 1e-10; // first shift relative to the largest diagonal entry
+        double growth = 100;
+        bool cod = true;
+        double pivot_tolerance = 1e-12; // smallest accepted pivot relative to the largest
+    };
+
+    // Solver for symmetric positive semi-definite systems such as J^T J, trying in order LDLT, LDLT of A + mu*I
+    // with a growing shift mu and a complete orthogonal decomposition. It never throws nor prints, the method 
+    // that succeeded is reported instead. A is copied to a workspace, so it is left untouched.
+    template<typename MatrixType=Eigen::MatrixXd>
+    class SymmetricSolver {
+    private:
+        using RealScalar = typename MatrixType::RealScalar;
+
+        FallbackOptions options;
+        MatrixType work;
+        std::optional<cholesky::LDLT<MatrixType>> ldlt;
+        Eigen::CompleteOrthogonalDecomposition<MatrixType> cod;
+        Method method_ = Method::LDLT;
+        Status status_ = Status::Singular;
+        RealScalar shift_ = 0;
+
+        template<typename T>
+        bool factorize(const Eigen::MatrixBase<T>& A, const RealScalar mu){
+            work = A;
+            if(mu>0) work.diagonal().array() += mu;
+            const auto& d = cholesky::LDLT<MatrixType>::compute(ldlt, work);
+            if(d.info()!=Eigen::Success) return false;
+            const auto D = d.decomposed().vectorD();
+            return D.size()==0 || D.minCoeff() > RealScalar(options.pivot_tolerance)*D.cwiseAbs().maxCoeff();
+        }
+
+    public:
+        explicit SymmetricSolver(const FallbackOptions& options=FallbackOptions())
+        : options(options) {}
+
+        template<typename T>
+        Status compute(const Eigen::MatrixBase<T>& A){
+            NON_LIN_OPTIM_TRACE_SCOPE_ARG("solvelin", "SymmetricSolver::compute", "n", A.rows());
+            shift_ = 0;
+            if(A.rows()!=A.cols()) return status_ = Status::NotSquare;
+
+            status_ = Status::Success;
+            method_ = Method::LDLT;
+            if(factorize(A, 0)) return status_;
+
+            if(options.regularize && A.rows()>0){
+                method_ = Method::Regularized;
+                RealScalar mu = RealScalar(options.regularization)*std::max(A.diagonal().cwiseAbs().maxCoeff(), RealScalar(1e-300));
+                for(int i=0; i<options.max_regularizations; ++i, mu *= RealScalar(options.growth)){
+                    shift_ = mu;
+                    if(factorize(A, mu)) return status_;
+                }
+                shift_ = 0;
+            }
+
+            if(options.cod){
+                method_ = Method::COD;
+                cod.compute(A);
+                return status_;
+            }
+            return status_ = Status::NotPositiveDefinite;
+        }
+
+        template<typename U>
+        Result<typename U::PlainObject> solve(const Eigen::MatrixBase<U>& b) const {
+            NON_LIN_OPTIM_TRACE_SCOPE("solvelin", "SymmetricSolver::solve");
+            if(status_!=Status::Success) return {{}, status_};
+            if(method_==Method::COD) return {cod.solve(b)};
+            return {ldlt->solve(b)};
+        }
+
+        Status status() const {
+            return status_;
+        }
+
+        Method method() const {
+            return method_;
+        }
+
+        // mu added to the diagonal when the method is Regularized
+        RealScalar shift() const {
+            return shift_;
+        }
+    };
+
+    // Solver for symmetric positive definite systems factorizing a Low precision copy of A and refining the solution 
+    // with residuals computed in A's precision. When refinement stalls A is factorized in full precision instead.
+    // A must stay alive and unchanged between compute() and the solves.
+    template<typename Low=float, typename MatrixType=Eigen::MatrixXd>
+    class MixedPrecisionSolver {
+    private:
+        using LowMatrix = Eigen::Matrix<Low, Eigen::Dynamic, Eigen::Dynamic>;
+        using RealScalar = typename MatrixType::RealScalar;
+        using VectorType = Eigen::Matrix<typename MatrixType::Scalar, Eigen::Dynamic, 1>;
+
+        const MatrixType* A = nullptr;
+        LowMatrix low;
+        std::optional<cholesky::LDLT<LowMatrix>> ldlt_low;
+        mutable std::optional<Eigen::LDLT<MatrixType>> ldlt_full;
+        Status status_ = Status::Singular;
+        mutable int refinements_ = 0;
+        RealScalar tol;
+        int max_refinements;
+        double pivot_tolerance;
+
+        template<typename L>
+        static bool valid(const L& ldlt, const double pivot_tolerance){
+            if(ldlt.info()!=Eigen::Success) return false;
+            const auto D = ldlt.vectorD();
+            return D.size()==0 || D.minCoeff() > pivot_tolerance*D.cwiseAbs().maxCoeff();
+        }
+
+        Result<VectorType> solve_full(const VectorType& b) const {
+            if(!ldlt_full) ldlt_full.emplace(*A);
+            if(!valid(*ldlt_full, 1e-12)) return {{}, Status::NotPositiveDefinite};
+            return {ldlt_full->solve(b)};
+        }
+
+    public:
+        explicit MixedPrecisionSolver(const RealScalar tol=1e-14, const int max_refinements=10, const double pivot_tolerance=1e-6)
+        : tol(tol), max_refinements(max_refinements), pivot_tolerance(pivot_tolerance) {}
+
+        Status compute(const MatrixType& A){
+            NON_LIN_OPTIM_TRACE_SCOPE_ARG("solvelin", "MixedPrecisionSolver::compute", "n", A.rows());
+            this->A = &A;
+            ldlt_full.reset();
+            if(A.rows()!=A.cols()) return status_ = Status::NotSquare;
+            low = A.template cast<Low>();
+            const auto& ldlt = cholesky::LDLT<LowMatrix>::compute(ldlt_low, low);
+            if(!valid(ldlt.decomposed(), pivot_tolerance)){
+                ldlt_full.emplace(A);
+                if(!valid(*ldlt_full, 1e-12)) return status_ = Status::NotPositiveDefinite;
+            }
+            return status_ = Status::Success;
+        }
+
+        Result<VectorType> solve(const VectorType& b) const {
+            NON_LIN_OPTIM_TRACE_SCOPE("solvelin", "MixedPrecisionSolver::solve");
+            refinements_ = 0;
+            if(status_!=Status::Success) return {{}, status_};
+            if(ldlt_full) return solve_full(b);
+
+            VectorType x = ldlt_low->solve(b.template cast<Low>()).template cast<typename MatrixType::Scalar>();
+            const RealScalar scale = A->template lpNorm<Eigen::Infinity>();
+            RealScalar prev = std::numeric_limits<RealScalar>::max();
+            for(; refinements_<=max_refinements; ++refinements_){
+                const VectorType r = b - (*A)*x;
+                const RealScalar error = r.template lpNorm<Eigen::Infinity>();
+                if(!std::isfinite(error)) break;
+                if(error <= tol*(scale*x.template lpNorm<Eigen::Infinity>() + b.template lpNorm<Eigen::Infinity>()))
+                    return {x};
+                // the low precision factors are not accurate enough for A
+                if(error > prev/2) break;
+                prev = error;
+                x += ldlt_low->solve(r.template cast<Low>()).template cast<typename MatrixType::Scalar>();
+            }
+            return solve_full(b);
+        }
+
+        Status status() const {
+            return status_;
+        }
+
+        // Refinement steps of the last solve
+        int refinements() const {
+            return refinements_;
+        }
+
+        // True once the low precision factorization or refinement failed and A was factorized in full precision
+        bool full_precision() const {
+            return ldlt_full.has_value();
+        }
+    };
+
+namespace iterative {
+
+    struct Info {
+        int iterations = 0;
+        double error = 0; // relative residual, ||A^T r||/(||A|| ||r||) for lsqr
+        bool converged = false;
+        bool breakdown = false; // cg met a direction of non-positive curvature, A is not positive definite
+    };
+
+    template<typename T>
+    constexpr bool is_sparse = std::is_base_of_v<Eigen::SparseMatrixBase<T>, T>;
+
+    template<typename Scalar>
+    class Identity {
+    public:
+        using VectorType = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
+
+        Identity() {}
+
+        template<typename T>
+        explicit Identity(const T&) {}
+
+        VectorType solve(const VectorType& r) const {
+            return r;
+        }
+
+        VectorType solve_transpose(const VectorType& r) const {
+            return r;
+        }
+    };
+
+    template<typename Scalar>
+    class Jacobi {
+    private:
+        Eigen::Matrix<Scalar, Eigen::Dynamic, 1> inv_diag;
+    public:
+        using VectorType = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
+
+        template<typename T>
+        explicit Jacobi(const T& A) 
+        : inv_diag(A.diagonal()) {
+            for(Eigen::Index i=0; i<inv_diag.size(); ++i)
+                inv_diag(i) = inv_diag(i)!=Scalar(0) ? Scalar(1)/inv_diag(i) : Scalar(1);
+        }
+
+        VectorType solve(const VectorType& r) const {
+            return inv_diag.cwiseProduct(r);
+        }
+    };
+
+    template<typename Scalar>
+    class BlockJacobi {
+    private:
+        using MatrixType = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>;
+        std::vector<Eigen::LDLT<MatrixType>> blocks;
+        const Eigen::Index block_size;
+    public:
+        using VectorType = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
+
+        template<typename T>
+        BlockJacobi(const T& A, const Eigen::Index block_size) 
+        : block_size(block_size) {
+            if(block_size<=0)
+                throw std::invalid_argument("Block size must be positive!");
+            for(Eigen::Index i=0; i<A.rows(); i+=block_size){
+                const Eigen::Index b = std::min(block_size, A.rows()-i);
+                MatrixType block = A.block(i, i, b, b);
+                blocks.emplace_back(block);
+            }
+        }
+
+        VectorType solve(const VectorType& r) const {
+            VectorType z(r.size());
+            for(size_t k=0; k<blocks.size(); ++k){
+                const Eigen::Index i = k*block_size;
+                const Eigen::Index b = std::min(block_size, r.size()-i);
+                z.segment(i, b) = blocks[k].solve(r.segment(i, b));
+            }
+            return z;
+        }
+    };
+
+    // Zero fill-in incomplete Cholesky, dense matrices are factorized on their nonzero pattern
+    template<typename Scalar>
+    class IncompleteCholesky {
+    private:
+        Eigen::IncompleteCholesky<Scalar, Eigen::Lower, Eigen::AMDOrdering<int>> ic;
+    public:
+        using VectorType = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
+
+        template<typename T>
+        explicit IncompleteCholesky(const T& A){
+            if constexpr (is_sparse<T>){
+                ic.compute(A);
+            } else {
+                Eigen::SparseMatrix<Scalar> sparse = A.sparseView();
+                ic.compute(sparse);
+            }
+            if(ic.info()!=Eigen::Success)
+                throw std::runtime_error("Incomplete Cholesky factorization failed!");
+        }
+
+        VectorType solve(const VectorType& r) const {
+            return ic.solve(r);
+        }
+    };
+
+    // Right preconditioner for lsqr scaling every column of A to unit norm
+    template<typename Scalar>
+    class ColumnScaling {
+    private:
+        Eigen::Matrix<Scalar, Eigen::Dynamic, 1> scale;
+    public:
+        using VectorType = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
+
+        template<typename T>
+        explicit ColumnScaling(const T& A) 
+        : scale(A.cols()) {
+            for(Eigen::Index j=0; j<A.cols(); ++j){
+                const Scalar norm = A.col(j).norm();
+                scale(j) = norm!=Scalar(0) ? Scalar(1)/norm : Scalar(1);
+            }
+        }
+
+        VectorType solve(const VectorType& r) const {
+            return scale.cwiseProduct(r);
+        }
+
+        VectorType solve_transpose(const VectorType& r) const {
+            return scale.cwiseProduct(r);
+        }
+    };
+
+    // Preconditioned conjugate gradient for symmetric positive definite A, x is used as initial guess when sized.
+    // max_iter<0 means 2*n iterations. It stops with breakdown set, leaving the last iterate in x, as soon as a
+    // direction of non-positive curvature shows that A is not positive definite.
+    template<typename T, typename U, typename P=Identity<typename T::Scalar>>
+    Info cg(const T& A, const Eigen::MatrixBase<U>& b, Eigen::Matrix<typename T::Scalar, Eigen::Dynamic, 1>& x,
+            const P& M=P(), const double tol=1e-10, int max_iter=-1){
+        NON_LIN_OPTIM_TRACE_SCOPE_ARG("solvelin", "iterative::cg", "n", A.rows());
+        using Scalar = typename T::Scalar;
+        using VectorType = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
+        if(A.rows()!=A.cols())
+            throw std::invalid_argument("A is not square!");
+        if(max_iter<0) max_iter = 2*A.cols();
+        if(x.size()!=A.cols()) x = VectorType::Zero(A.cols());
+
+        Info info;
+        const double b_norm = b.norm();
+        if(b_norm==0){
+            x.setZero();
+            info.converged = true;
+            return info;
+        }
+
+        VectorType r = b - A*x;
+        VectorType z = M.solve(r);
+        VectorType p = z;
+        VectorType Ap(A.rows());
+        Scalar rz = r.dot(z);
+        for(; info.iterations<max_iter; ++info.iterations){
+            info.error = r.norm()/b_norm;
+            if(info.error<=tol) break;
+            Ap.noalias() = A*p;
+            const Scalar pAp = p.dot(Ap);
+            if(!(pAp>0)){
+                info.breakdown = true;
+                break;
+            }
+            const Scalar alpha = rz/pAp;
+            x += alpha*p;
+            r -= alpha*Ap;
+            z = M.solve(r);
+            const Scalar rz_new = r.dot(z);
+            p = z + (rz_new/rz)*p;
+            rz = rz_new;
+        }
+        info.error = r.norm()/b_norm;
+        info.converged = info.error<=tol;
+        return info;
+    }
+
+    // Preconditioned MINRES for symmetric, possibly indefinite A with a symmetric positive definite preconditioner
+    template<typename T, typename U, typename P=Identity<typename T::Scalar>>
+    Info minres(const T& A, const Eigen::MatrixBase<U>& b, Eigen::Matrix<typename T::Scalar, Eigen::Dynamic, 1>& x,
+                const P& M=P(), const double tol=1e-10, int max_iter=-1){
+        NON_LIN_OPTIM_TRACE_SCOPE_ARG("solvelin", "iterative::minres", "n", A.rows());
+        using Scalar = typename T::Scalar;
+        using VectorType = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
+        if(A.rows()!=A.cols())
+            throw std::invalid_argument("A is not square!");
+        if(max_iter<0) max_iter = 2*A.cols();
+        if(x.size()!=A.cols()) x = VectorType::Zero(A.cols());
+
+        Info info;
+        const double b_norm = b.norm();
+        if(b_norm==0){
+            x.setZero();
+            info.converged = true;
+            return info;
+        }
+
+        // preconditioned Lanczos with Givens rotations, Paige & Saunders (1975)
+        VectorType v = VectorType::Zero(A.cols());
+        VectorType v_old;
+        VectorType v_new = b - A*x;
+        VectorType w;
+        VectorType w_new = M.solve(v_new);
+        Scalar beta_new = v_new.dot(w_new);
+        if(beta_new<0)
+            throw std::runtime_error("Preconditioner is not positive definite!");
+        beta_new = sqrt(beta_new);
+        const Scalar beta_one = beta_new;
+        double residual = v_new.norm();
+
+        Scalar c = 1, c_old = 1, s = 0, s_old = 0, eta = 1;
+        VectorType p = VectorType::Zero(A.cols());
+        VectorType p_old = p;
+        VectorType p_oold;
+        while(info.iterations<max_iter && residual>tol*b_norm && beta_new>0){
+            const Scalar beta = beta_new;
+            v_old = v;
+            v = v_new/beta;
+            w = w_new/beta;
+            v_new.noalias() = A*w;
+            v_new -= beta*v_old;
+            const Scalar alpha = v_new.dot(w);
+            v_new -= alpha*v;
+            w_new = M.solve(v_new);
+            beta_new = v_new.dot(w_new);
+            if(beta_new<0)
+                throw std::runtime_error("Preconditioner is not positive definite!");
+            beta_new = sqrt(beta_new);
+
+            const Scalar r2 = s*alpha + c*c_old*beta;
+            const Scalar r3 = s_old*beta;
+            const Scalar r1_hat = c*alpha - c_old*s*beta;
+            const Scalar r1 = sqrt(r1_hat*r1_hat + beta_new*beta_new);
+            c_old = c;
+            s_old = s;
+            c = r1_hat/r1;
+            s = beta_new/r1;
+
+            p_oold = p_old;
+            p_old = p;
+            p = (w - r2*p_old - r3*p_oold)/r1;
+            x += beta_one*c*eta*p;
+
+            residual *= std::abs(s);
+            eta = -s*eta;
+            info.iterations++;
+        }
+        info.error = (b - A*x).norm()/b_norm;
+        info.converged = info.error<=tol || residual<=tol*b_norm;
+        return info;
+    }
+
+    // LSQR for min ||A x - b|| with a rectangular A and a right preconditioner N (x = N y), Paige & Saunders (1982).
+    // The preconditioner needs solve(v) = N v and solve_transpose(v) = N^T v.
+    template<typename T, typename U, typename P=Identity<typename T::Scalar>>
+    Info lsqr(const T& A, const Eigen::MatrixBase<U>& b, Eigen::Matrix<typename T::Scalar, Eigen::Dynamic, 1>& x,
+              const P& N=P(), const double tol=1e-10, int max_iter=-1){
+        NON_LIN_OPTIM_TRACE_SCOPE_ARG("solvelin", "iterative::lsqr", "m", A.rows());
+        using Scalar = typename T::Scalar;
+        using VectorType = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
+        if(A.rows()!=b.rows())
+            throw std::invalid_argument("A and b have different number of rows!");
+        if(max_iter<0) max_iter = 2*A.cols();
+        if(x.size()!=A.cols()) x = VectorType::Zero(A.cols());
+
+        Info info;
+        VectorType u = b - A*x;
+        Scalar beta = u.norm();
+        if(beta==0){
+            info.converged = true;
+            return info;
+        }
+        u /= beta;
+        VectorType v = N.solve_transpose(A.transpose()*u);
+        Scalar alpha = v.norm();
+        if(alpha==0){
+            info.converged = true;
+            return info;
+        }
+        v /= alpha;
+
+        VectorType w = v;
+        VectorType y = VectorType::Zero(A.cols());
+        Scalar phi_bar = beta;
+        Scalar rho_bar = alpha;
+        double A_norm = 0;
+        while(info.iterations<max_iter){
+            u = A*N.solve(v) - alpha*u;
+            beta = u.norm();
+            if(beta>0) u /= beta;
+            A_norm = sqrt(A_norm*A_norm + double(alpha)*alpha + double(beta)*beta);
+
+            v = N.solve_transpose(A.transpose()*u) - beta*v;
+            alpha = v.norm();
+            if(alpha>0) v /= alpha;
+
+            const Scalar rho = sqrt(rho_bar*rho_bar + beta*beta);
+            const Scalar c = rho_bar/rho;
+            const Scalar s = beta/rho;
+            const Scalar theta = s*alpha;
+            rho_bar = -c*alpha;
+            const Scalar phi = c*phi_bar;
+            phi_bar = s*phi_bar;
+
+            y += (phi/rho)*w;
+            w = v - (theta/rho)*w;
+            info.iterations++;
+
+            // ||r|| = phi_bar and ||A^T r|| = phi_bar*alpha*|c|
+            const double residual = std::abs(phi_bar);
+            info.error = residual>0 ? std::abs(phi_bar*alpha*c)/(A_norm*residual) : 0;
+            if(residual<=tol*b.norm() || info.error<=tol || alpha==0){
+                info.converged = true;
+                break;
+            }
+        }
+        x += N.solve(y);
+        return info;
+    }
+
+} // end namespace iterative
+
+namespace randomized {
+
+    // Sparse sign embedding S (s x m) with k entries +-1/sqrt(k) per column, S*A costs O(k nnz(A))
+    template<typename Scalar=double>
+    Eigen::SparseMatrix<Scalar> sparse_sign(const Eigen::Index s, const Eigen::Index m, const int k=8, const uint64_t seed=0){
+        if(s<=0 || k<=0)
+            throw std::invalid_argument("Sketch size must be positive!");
+        const Eigen::Index nnz = std::min<Eigen::Index>(k, s);
+        const Scalar value = Scalar(1)/std::sqrt(Scalar(nnz));
+        std::mt19937_64 rng(seed);
+        std::uniform_int_distribution<Eigen::Index> row(0, s-1);
+        std::vector<Eigen::Triplet<Scalar>> triplets;
+        triplets.reserve(nnz*m);
+        std::vector<Eigen::Index> rows(nnz);
+        for(Eigen::Index j=0; j<m; ++j){
+            for(Eigen::Index i=0; i<nnz; ++i){
+                // distinct rows within a column
+                do { rows[i] = row(rng); } while(std::find(rows.begin(), rows.begin()+i, rows[i])!=rows.begin()+i);
+                triplets.emplace_back(rows[i], j, (rng() & 1) ? value : -value);
+            }
+        }
+        Eigen::SparseMatrix<Scalar> S(s, m);
+        S.setFromTriplets(triplets.begin(), triplets.end());
+        return S;
+    }
+
+    // Right preconditioner R^-1 for lsqr from the QR decomposition of a sketch S*A, Blendenpik / LSRN style.
+    // A*R^-1 is well conditioned whatever the conditioning of A, so lsqr converges in a few tens of iterations.
+    // A must have full column rank.
+    template<typename Scalar>
+    class SketchPreconditioner {
+    private:
+        using MatrixType = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>;
+        Eigen::HouseholderQR<MatrixType> qr;
+        Eigen::SparseMatrix<Scalar> S;
+    public:
+        using VectorType = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
+
+        template<typename T>
+        explicit SketchPreconditioner(const T& A, const double oversampling=4, const uint64_t seed=0)
+        : S(sparse_sign<Scalar>(std::max<Eigen::Index>(A.cols()+1, Eigen::Index(oversampling*A.cols())), A.rows(), 8, seed)) {
+            MatrixType SA = S*A;
+            qr.compute(SA);
+        }
+
+        VectorType solve(const VectorType& r) const {
+            const auto n = qr.matrixQR().cols();
+            return qr.matrixQR().topRows(n).template triangularView<Eigen::Upper>().solve(r);
+        }
+
+        VectorType solve_transpose(const VectorType& r) const {
+            const auto n = qr.matrixQR().cols();
+            return qr.matrixQR().topRows(n).template triangularView<Eigen::Upper>().transpose().solve(r);
+        }
+
+        // Sketch-and-solve estimate argmin ||S (A x - b)||, a good starting point for lsqr
+        template<typename U>
+        VectorType initial_guess(const Eigen::MatrixBase<U>& b) const {
+            return qr.solve(S*b);
+        }
+    };
+
+    // Least squares min ||A x - b|| for tall A (m >> n): lsqr preconditioned by a sketch of A, O(nnz(A) + n^3) to build
+    // and O(mn) per iteration with an iteration count independent of the conditioning of A.
+    // x is used as initial guess when sized, otherwise the sketch-and-solve estimate is used.
+    template<typename T, typename U>
+    iterative::Info lstsq(const T& A, const Eigen::MatrixBase<U>& b, Eigen::Matrix<typename T::Scalar, Eigen::Dynamic, 1>& x,
+                          const double tol=1e-12, const int max_iter=-1, const uint64_t seed=0){
+        if(A.rows()<A.cols())
+            throw std::invalid_argument("A must have at least as many rows as columns!");
+        NON_LIN_OPTIM_TRACE_SCOPE_ARG("solvelin", "randomized::lstsq", "m", A.rows());
+        const SketchPreconditioner<typename T::Scalar> N(A, 4, seed);
+        if(x.size()!=A.cols()) x = N.initial_guess(b);
+        return iterative::lsqr(A, b, x, N, tol, max_iter<0 ? 100 : max_iter);
+    }
+
+} // end namespace randomized
+
+    enum class LeastSquares {
+        NormalEquations,
+        HouseholderQR,
+        ColPivQR,
+        Sketch
+    };
+
+    inline
+    const char* to_string(const LeastSquares method){
+        switch(method){
+            case LeastSquares::NormalEquations: return "NormalEquations";
+            case LeastSquares::HouseholderQR: return "HouseholderQR";
+            case LeastSquares::ColPivQR: return "ColPivQR";
+            case LeastSquares::Sketch: return "Sketch";
+        }
+        return "";
+    }
+
+    // Parameters of the least-squares method selection, the defaults or the fastest methods measured by calibrate()
+    struct Tuning {
+        struct Entry {
+            Eigen::Index rows;
+            Eigen::Index cols;
+            LeastSquares method;
+        };
+
+        double max_condition = 1e5; // condition estimate above which A is solved by rank revealing QR, A^T A would square it
+        double qr_ratio = 2;        // rows per column up to which Householder QR is used when nothing was measured
+        double sketch_ratio = 20;   // rows per column from which sketching is used when nothing was measured
+        double sketch_row_nnz = 16; // nonzeros per row below which forming A^T A is cheaper than lsqr iterations
+        std::vector<Entry> fastest; // fastest well-conditioned method measured per shape
+
+        void save(const std::string& path) const {
+            std::ofstream out(path, std::ios::trunc);
+            if(!out)
+                throw std::runtime_error("Cannot open " + path + " for writing!");
+            out.precision(17);
+            out << "max_condition " << max_condition << "\n"
+                << "qr_ratio " << qr_ratio << "\n"
+                << "sketch_ratio " << sketch_ratio << "\n"
+                << "sketch_row_nnz " << sketch_row_nnz << "\n";
+            for(const auto& e:fastest)
+                out << "fastest " << e.rows << " " << e.cols << " " << to_string(e.method) << "\n";
+            if(!out)
+                throw std::runtime_error("Cannot write " + path + "!");
+        }
+
+        static Tuning load(const std::string& path){
+            std::ifstream in(path);
+            if(!in)
+                throw std::runtime_error("Cannot open " + path + "!");
+            Tuning tuning;
+            std::string key;
+            while(in >> key){
+                if(key=="max_condition") in >> tuning.max_condition;
+                else if(key=="qr_ratio") in >> tuning.qr_ratio;
+                else if(key=="sketch_ratio") in >> tuning.sketch_ratio;
+                else if(key=="sketch_row_nnz") in >> tuning.sketch_row_nnz;
+                else if(key=="fastest"){
+                    Entry e{0, 0, LeastSquares::NormalEquations};
+                    std::string name;
+                    in >> e.rows >> e.cols >> name;
+                    bool known = false;
+                    for(auto method:{LeastSquares::NormalEquations, LeastSquares::HouseholderQR, LeastSquares::ColPivQR, LeastSquares::Sketch}){
+                        if(name==to_string(method)){
+                            e.method = method;
+                            known = true;
+                        }
+                    }
+                    if(!known || e.rows<=0 || e.cols<=0)
+                        throw std::runtime_error(path + " is not a valid tuning file!");
+                    tuning.fastest.push_back(e);
+                } else {
+                    throw std::runtime_error(path + " is not a valid tuning file!");
+                }
+                if(!in)
+                    throw std::runtime_error(path + " is not a valid tuning file!");
+            }
+            return tuning;
+        }
+    };
+
+    // Estimate of the 2-norm condition number of A with its columns scaled to unit norm, so that independent
+    // columns of very different scales are not reported ill-conditioned while nearly collinear ones are. It runs a
+    // few power and inverse iterations on the R factor of a QR of A, or of a sparse sign sketch of A when A has more
+    // than 4 rows per column, so it costs O(mn + n^3) for tall A. Infinite when A is wide or R is singular.
+    template<typename T>
+    typename T::RealScalar condition_estimate(const Eigen::MatrixBase<T>& A, const int iterations=8){
+        using Scalar = typename T::Scalar;
+        using RealScalar = typename T::RealScalar;
+        using MatrixType = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>;
+        using VectorType = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
+        constexpr RealScalar infinity = std::numeric_limits<RealScalar>::infinity();
+        const Eigen::Index m = A.rows();
+        const Eigen::Index n = A.cols();
+        if(n==0) return RealScalar(1);
+        if(m<n) return infinity;
+
+        const auto norms = A.colwise().norm().eval();
+        if(!(norms.minCoeff()>0)) return infinity;
+        MatrixType scaled = A*norms.cwiseInverse().asDiagonal();
+        if(m>4*n) scaled = (randomized::sparse_sign<Scalar>(4*n, m)*scaled).eval();
+        const Eigen::HouseholderQR<Eigen::Ref<MatrixType>> qr(scaled);
+        const auto R = qr.matrixQR().topRows(n).template triangularView<Eigen::Upper>();
+        if(!(qr.matrixQR().diagonal().cwiseAbs().minCoeff()>0)) return infinity;
+
+        // largest eigenvalues of R^T R and of its inverse, from a fixed pseudo-random start
+        std::mt19937_64 rng(0);
+        std::normal_distribution<RealScalar> normal;
+        const VectorType start = VectorType::NullaryExpr(n, [&](){ return Scalar(normal(rng)); }).normalized();
+        VectorType u = start;
+        VectorType v = start;
+        RealScalar largest = 0;
+        RealScalar inverse_smallest = 0;
+        for(int i=0; i<iterations; ++i){
+            u = R.transpose()*(R*u).eval();
+            largest = u.norm();
+            u /= largest;
+            v = R.solve(R.transpose().solve(v));
+            inverse_smallest = v.norm();
+            if(!std::isfinite(inverse_smallest)) return infinity;
+            v /= inverse_smallest;
+        }
+        return std::sqrt(largest*inverse_smallest);
+    }
+
+    // Method for min ||A x - b|| from the shape, density and condition estimate of A. Ill-conditioned or wide A is
+    // solved by rank revealing QR, otherwise the fastest measured method of the nearest calibrated shape is used, 
+    // or when nothing was measured Householder QR for nearly square A, sketching for tall and dense enough A and
+    // the normal equations in between.
+    template<typename T>
+    LeastSquares select(const Eigen::MatrixBase<T>& A, const Tuning& tuning=Tuning()){
+        const Eigen::Index m = A.rows();
+        const Eigen::Index n = A.cols();
+        if(m<n || condition_estimate(A)>tuning.max_condition)
+            return LeastSquares::ColPivQR;
+        if(n==0)
+            return LeastSquares::NormalEquations;
+
+        // the sketch must have fewer rows than A to pay off, and its lsqr iterations cost O(nnz(A)) each
+        const double row_nnz = double((A.array()!=typename T::Scalar(0)).count())/m;
+        const bool sketchable = m>=4*n && row_nnz>=tuning.sketch_row_nnz;
+
+        if(!tuning.fastest.empty()){
+            auto distance = [&](const Tuning::Entry& e){
+                return std::abs(std::log(double(m)/e.rows)) + std::abs(std::log(double(n)/e.cols));
+            };
+            const auto nearest = *std::min_element(tuning.fastest.begin(), tuning.fastest.end(), 
+                [&](const auto& a, const auto& b){ return distance(a)<distance(b); });
+            if(nearest.method==LeastSquares::Sketch && !sketchable)
+                return LeastSquares::NormalEquations;
+            return nearest.method;
+        }
+
+        if(sketchable && m>=tuning.sketch_ratio*n)
+            return LeastSquares::Sketch;
+        if(m<=tuning.qr_ratio*n)
+            return LeastSquares::HouseholderQR;
+        return LeastSquares::NormalEquations;
+    }
+
+    // Least squares min ||A x - b|| with the method chosen by select(). When the normal equations or Householder QR
+    // turn out rank deficient, or sketched lsqr does not converge, A is solved by rank revealing QR instead.
+    // A must stay alive and unchanged between compute() and the solves.
+    template<typename MatrixType=Eigen::MatrixXd>
+    class LeastSquaresSolver {
+    private:
+        using Scalar = typename MatrixType::Scalar;
+        using RealScalar = typename MatrixType::RealScalar;
+        using VectorType = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
+
+        Tuning tuning;
+        FallbackOptions options;
+        const MatrixType* A = nullptr;
+        MatrixType AtA;
+        VectorType scale; // D of the equilibrated normal equations (D A^T A D) y = D A^T b, x = D y
+        SymmetricSolver<MatrixType> normal;
+        Eigen::HouseholderQR<MatrixType> qr;
+        mutable Eigen::ColPivHouseholderQR<MatrixType> cpqr;
+        std::optional<randomized::SketchPreconditioner<Scalar>> sketch;
+        LeastSquares selected_ = LeastSquares::NormalEquations;
+        mutable LeastSquares method_ = LeastSquares::NormalEquations;
+
+        void rank_revealing() const {
+            method_ = LeastSquares::ColPivQR;
+            cpqr.compute(*A);
+        }
+
+    public:
+        explicit LeastSquaresSolver(const Tuning& tuning=Tuning(), const FallbackOptions& options=FallbackOptions())
+        : tuning(tuning), options(options), normal(options) {}
+
+        LeastSquares compute(const MatrixType& A){
+            return compute(A, select(A, tuning));
+        }
+
+        // Factorizes A with the given method, bypassing the selection
+        LeastSquares compute(const MatrixType& A, const LeastSquares method){
+            NON_LIN_OPTIM_TRACE_SCOPE_ARG("solvelin", "LeastSquaresSolver::compute", "m", A.rows());
+            this->A = &A;
+            sketch.reset();
+            selected_ = method_ = method;
+            switch(method){
+                case LeastSquares::NormalEquations:
+                    AtA.noalias() = A.transpose()*A;
+                    // unit diagonal, so that the pivot test of the LDLT does not depend on the column scales
+                    scale = AtA.diagonal().cwiseSqrt();
+                    for(Eigen::Index i=0; i<scale.size(); ++i)
+                        scale(i) = scale(i)>RealScalar(0) ? Scalar(1)/scale(i) : Scalar(1);
+                    AtA = scale.asDiagonal()*AtA*scale.asDiagonal();
+                    normal.compute(AtA);
+                    if(normal.method()!=Method::LDLT) rank_revealing();
+                    break;
+                case LeastSquares::HouseholderQR: {
+                    qr.compute(A);
+                    const auto R = qr.matrixQR().diagonal().cwiseAbs();
+                    if(A.rows()<A.cols() || (R.size()>0 && !(R.minCoeff() > RealScalar(options.pivot_tolerance)*R.maxCoeff()))) 
+                        rank_revealing();
+                    break;
+                }
+                case LeastSquares::ColPivQR:
+                    rank_revealing();
+                    break;
+                case LeastSquares::Sketch:
+                    if(A.rows()>A.cols()) sketch.emplace(A);
+                    else rank_revealing();
+                    break;
+            }
+            return method_;
+        }
+
+        Result<VectorType> solve(const VectorType& b) const {
+            NON_LIN_OPTIM_TRACE_SCOPE("solvelin", "LeastSquaresSolver::solve");
+            if(!A) return {{}, Status::Singular};
+            if(b.size()!=A->rows())
+                throw std::invalid_argument("b must have as many rows as A!");
+            switch(method_){
+                case LeastSquares::NormalEquations: {
+                    auto y = normal.solve((scale.asDiagonal()*(A->transpose()*b)).eval());
+                    if(y) y.x = scale.asDiagonal()*y.x;
+                    return y;
+                }
+                case LeastSquares::HouseholderQR:
+                    return {qr.solve(b)};
+                case LeastSquares::Sketch: {
+                    VectorType x = sketch->initial_guess(b);
+                    if(iterative::lsqr(*A, b, x, *sketch, 1e-12, 100).converged && x.allFinite())
+                        return {x};
+                    rank_revealing();
+                    break;
+                }
+                case LeastSquares::ColPivQR:
+                    break;
+            }
+            return {cpqr.solve(b)};
+        }
+
+        // Method picked by compute()
+        LeastSquares selected() const {
+            return selected_;
+        }
+
+        // Method actually used, ColPivQR once the selected one failed
+        LeastSquares method() const {
+            return method_;
+        }
+    };
+
+    // Times the well-conditioned candidates on random dense matrices of the given (rows, cols) shapes and records the
+    // fastest per shape. It takes about a second with the default shapes, the result is meant to be saved and reused.
+    inline
+    Tuning calibrate(const std::vector<std::pair<Eigen::Index, Eigen::Index>>& shapes={{16, 8}, {64, 8}, {512, 8}, {4096, 8},
+                                                                                      {64, 32}, {256, 32}, {2048, 32}, {16384, 32},
+                                                                                      {256, 128}, {1024, 128}, {8192, 128}},
+                     const int repeats=3, Tuning tuning=Tuning()){
+        using clock = std::chrono::steady_clock;
+        tuning.fastest.clear();
+        std::mt19937_64 rng(0);
+        std::normal_distribution<double> normal;
+        LeastSquaresSolver<Eigen::MatrixXd> solver(tuning);
+        for(const auto& [m, n]:shapes){
+            if(m<n || n<=0)
+                throw std::invalid_argument("Calibration shapes must have at least as many rows as columns!");
+            const Eigen::MatrixXd A = Eigen::MatrixXd::NullaryExpr(m, n, [&](){ return normal(rng); });
+            const Eigen::VectorXd b = Eigen::VectorXd::NullaryExpr(m, [&](){ return normal(rng); });
+
+            Tuning::Entry best{m, n, LeastSquares::NormalEquations};
+            double best_time = std::numeric_limits<double>::max();
+            for(auto method:{LeastSquares::NormalEquations, LeastSquares::HouseholderQR, LeastSquares::Sketch}){
+                if(method==LeastSquares::Sketch && m<4*n) continue;
+                double time = std::numeric_limits<double>::max();
+                for(int r=0; r<repeats; ++r){
+                    const auto start = clock::now();
+                    solver.compute(A, method);
+                    const auto x = solver.solve(b);
+                    const double elapsed = std::chrono::duration<double>(clock::now()-start).count();
+                    // a method falling back is not a candidate on this shape
+                    if(!x || solver.method()!=method) break;
+                    time = std::min(time, elapsed);
+                }
+                if(time<best_time){
+                    best_time = time;
+                    best.method = method;
+                }
+            }
+            tuning.fastest.push_back(best);
+        }
+        return tuning;
+    }
+
+    // Loads the tuning file at path, or calibrates and writes it when it does not exist yet
+    inline
+    Tuning load_or_calibrate(const std::string& path){
+        if(std::ifstream(path)) 
+            return Tuning::load(path);
+        Tuning tuning = calibrate();
+        tuning.save(path);
+        return tuning;
+    }
+
 } // end namespace solvelin
\ No newline at end of file
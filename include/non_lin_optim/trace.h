@@ -0,0 +1,269 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Trace points are compiled in with -DNON_LIN_OPTIM_TRACE=1, otherwise the macros expand to nothing and their
+// arguments are not evaluated. Compiled in, they record only between trace::start() and trace::stop().
+#ifndef NON_LIN_OPTIM_TRACE
+#define NON_LIN_OPTIM_TRACE 0
+#endif
+
+#define NON_LIN_OPTIM_TRACE_CONCAT_(a, b) a##b
+#define NON_LIN_OPTIM_TRACE_CONCAT(a, b) NON_LIN_OPTIM_TRACE_CONCAT_(a, b)
+
+#if NON_LIN_OPTIM_TRACE
+#define NON_LIN_OPTIM_TRACE_SCOPE(category, name) \
+    ::non_lin_optim::trace::Scope NON_LIN_OPTIM_TRACE_CONCAT(trace_scope_, __LINE__)(category, name)
+#define NON_LIN_OPTIM_TRACE_SCOPE_ARG(category, name, arg_name, arg) \
+    ::non_lin_optim::trace::Scope NON_LIN_OPTIM_TRACE_CONCAT(trace_scope_, __LINE__)(category, name, arg_name, arg)
+#define NON_LIN_OPTIM_TRACE_THREAD_NAME(name) ::non_lin_optim::trace::name_thread(name)
+#else
+#define NON_LIN_OPTIM_TRACE_SCOPE(category, name) ((void)0)
+#define NON_LIN_OPTIM_TRACE_SCOPE_ARG(category, name, arg_name, arg) ((void)0)
+#define NON_LIN_OPTIM_TRACE_THREAD_NAME(name) ((void)0)
+#endif
+
+namespace non_lin_optim {
+
+namespace trace {
+
+    using Clock = std::chrono::steady_clock;
+
+    // Complete event, names are string literals of which only the pointer is stored
+    struct Event {
+        const char* category;
+        const char* name;
+        const char* arg_name;   // nullptr when the event has no argument
+        int64_t arg;
+        int64_t start;          // ns since the trace epoch
+        int64_t duration;       // ns
+    };
+
+    // Events of one thread, in chunks allocated on demand. Only the owning thread appends, each event is
+    // published by a release store of the size so that exporting does not lock nor stop the writer.
+    class Buffer {
+    private:
+        static constexpr size_t chunk_size = 4096;
+        static constexpr size_t max_chunks = 1024;
+
+        std::array<std::atomic<Event*>, max_chunks> chunks{};
+        std::atomic<size_t> size{0};
+        std::atomic<size_t> dropped_{0};
+        std::string name_;
+
+    public:
+        const int tid;
+
+        explicit Buffer(const int tid) : name_("thread " + std::to_string(tid)), tid(tid) {}
+
+        Buffer(const Buffer&) = delete;
+        Buffer& operator=(const Buffer&) = delete;
+
+        ~Buffer(){
+            for(auto& chunk:chunks)
+                delete[] chunk.load(std::memory_order_relaxed);
+        }
+
+        void push(const Event& event){
+            const size_t n = size.load(std::memory_order_relaxed);
+            const size_t c = n/chunk_size;
+            if(c>=max_chunks){
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            Event* chunk = chunks[c].load(std::memory_order_relaxed);
+            if(!chunk){
+                chunk = new Event[chunk_size];
+                chunks[c].store(chunk, std::memory_order_release);
+            }
+            chunk[n%chunk_size] = event;
+            size.store(n+1, std::memory_order_release);
+        }
+
+        // Visits the events published so far, may run while the owning thread keeps appending
+        template<typename F>
+        void for_each(F&& f) const {
+            const size_t n = size.load(std::memory_order_acquire);
+            for(size_t i=0; i<n; ++i)
+                f(chunks[i/chunk_size].load(std::memory_order_acquire)[i%chunk_size]);
+        }
+
+        // Not safe while the owning thread records
+        void clear(){
+            size.store(0, std::memory_order_relaxed);
+            dropped_.store(0, std::memory_order_relaxed);
+        }
+
+        size_t dropped() const {
+            return dropped_.load(std::memory_order_relaxed);
+        }
+
+        const std::string& name() const {
+            return name_;
+        }
+
+        void rename(const std::string& name){
+            name_ = name;
+        }
+    };
+
+    // Buffers of every thread that recorded, kept after the threads exit until the end of the program
+    class Registry {
+    private:
+        std::vector<std::shared_ptr<Buffer>> buffers;
+
+    public:
+        std::mutex mutex;
+        std::atomic<bool> enabled{false};
+        const Clock::time_point epoch = Clock::now();
+
+        std::shared_ptr<Buffer> add(){
+            std::lock_guard<std::mutex> lock(mutex);
+            buffers.push_back(std::make_shared<Buffer>(static_cast<int>(buffers.size())));
+            return buffers.back();
+        }
+
+        // Call with the mutex held
+        const std::vector<std::shared_ptr<Buffer>>& all() const {
+            return buffers;
+        }
+    };
+
+    inline
+    Registry& registry(){
+        static Registry instance;
+        return instance;
+    }
+
+    // Registers the calling thread on its first event
+    inline
+    Buffer& local_buffer(){
+        thread_local std::shared_ptr<Buffer> buffer = registry().add();
+        return *buffer;
+    }
+
+    inline
+    int64_t now(){
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now()-registry().epoch).count();
+    }
+
+    inline
+    bool enabled(){
+        return registry().enabled.load(std::memory_order_relaxed);
+    }
+
+    inline
+    void start(){
+        registry().enabled.store(true, std::memory_order_relaxed);
+    }
+
+    inline
+    void stop(){
+        registry().enabled.store(false, std::memory_order_relaxed);
+    }
+
+    // Discards the recorded events, to be called when no traced code runs
+    inline
+    void clear(){
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        for(const auto& buffer:r.all())
+            buffer->clear();
+    }
+
+    // Name of the calling thread in the exported trace
+    inline
+    void name_thread(const std::string& name){
+        Buffer& buffer = local_buffer();
+        std::lock_guard<std::mutex> lock(registry().mutex);
+        buffer.rename(name);
+    }
+
+    // Records the time between construction and destruction as a complete event of the calling thread
+    class Scope {
+    private:
+        const char* category;
+        const char* name;
+        const char* arg_name;
+        const int64_t arg;
+        const int64_t start;
+
+    public:
+        Scope(const char* category, const char* name, const char* arg_name=nullptr, const int64_t arg=0)
+        : category(category), name(name), arg_name(arg_name), arg(arg), start(enabled() ? now() : -1) {}
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+        ~Scope(){
+            if(start>=0)
+                local_buffer().push({category, name, arg_name, arg, start, now()-start});
+        }
+    };
+
+    // Writes the recorded events in the Chrome trace event format, loaded by chrome://tracing and ui.perfetto.dev
+    inline
+    void write_chrome_json(std::ostream& out){
+        auto quoted = [](const std::string& s){
+            std::string q = "\"";
+            for(char c:s){
+                if(c=='"' || c=='\\') q += '\\';
+                q += c;
+            }
+            return q + "\"";
+        };
+        auto us = [](const int64_t ns){
+            return std::to_string(ns/1000) + "." + std::to_string(1000+ns%1000).substr(1);
+        };
+
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        bool first = true;
+        auto separator = [&](){
+            out << (first ? "\n" : ",\n");
+            first = false;
+        };
+        for(const auto& buffer:r.all()){
+            separator();
+            out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid
+                << ",\"args\":{\"name\":" << quoted(buffer->name()) << "}}";
+            buffer->for_each([&](const Event& e){
+                separator();
+                out << "{\"name\":" << quoted(e.name) << ",\"cat\":" << quoted(e.category)
+                    << ",\"ph\":\"X\",\"ts\":" << us(e.start) << ",\"dur\":" << us(e.duration)
+                    << ",\"pid\":1,\"tid\":" << buffer->tid;
+                if(e.arg_name)
+                    out << ",\"args\":{" << quoted(e.arg_name) << ":" << e.arg << "}";
+                out << "}";
+            });
+            if(buffer->dropped()>0){
+                separator();
+                out << "{\"name\":\"dropped events\",\"ph\":\"C\",\"ts\":0,\"pid\":1,\"tid\":" << buffer->tid
+                    << ",\"args\":{\"dropped\":" << buffer->dropped() << "}}";
+            }
+        }
+        out << "\n]}\n";
+    }
+
+    inline
+    void save(const std::string& path){
+        std::ofstream out(path, std::ios::trunc);
+        if(!out)
+            throw std::runtime_error("Cannot open " + path + " for writing!");
+        write_chrome_json(out);
+    }
+
+} // end namespace trace
+
+} // end namespace non_lin_optim
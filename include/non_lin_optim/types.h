@@ -1,19 +1,86 @@
 #pragma once
 
 #include<Eigen/Dense>
+#include<Eigen/Sparse>
+#include<chrono>
+#include<functional>
+#include<limits>
+#include<ostream>
+#include<vector>
+
+#ifndef NON_LIN_OPTIM_STATS
+#define NON_LIN_OPTIM_STATS 1
+#endif
 
 namespace non_lin_optim {
 
+    template<typename T>
+    using MatrixT = Eigen::Matrix< T, Eigen::Dynamic, Eigen::Dynamic >;
+    template<typename T>
+    using VectorT = Eigen::Matrix< T, Eigen::Dynamic, 1 >;
+
     using Scalar = double;
-    using Matrix = Eigen::Matrix< Scalar, Eigen::Dynamic, Eigen::Dynamic >;
-    using Vector = Eigen::Matrix< Scalar, Eigen::Dynamic, 1 >;
+    using Matrix = MatrixT< Scalar >;
+    using Vector = VectorT< Scalar >;
+    using SparseMatrix = Eigen::SparseMatrix< Scalar >;
     using Func_v = std::function< Vector(const Vector &x) >;
     using Func_s = std::function< Scalar(const Vector &x) >;
+    using Func_chunk = std::function< Vector(const Vector &x, const int chunk) >;
+    using Func_basis = std::function< Matrix(const Vector &a) >;
+    using Func_indexed = std::function< Vector(const Vector &x, const std::vector<int> &rows) >; // residuals of the given rows
+    using Func_batch_v = std::function< Matrix(const Matrix &X) >; // residuals of every column of X, one column per point
+    using Func_batch_s = std::function< Vector(const Matrix &X) >; // value at every column of X
+    using Progress = std::function< void(const int iter, const Scalar error, const Vector &x) >;
+    using Clock = std::chrono::steady_clock;
+
+    inline constexpr bool collect_stats = NON_LIN_OPTIM_STATS;
 
     enum ResultInfo {
         Converged,
         MaxIterationReached,
-        TolleranceReached
+        TolleranceReached,
+        Stopped,
+        DeadlineReached
+    };
+
+    // Report of a run. Counters and phase timings are compiled out when NON_LIN_OPTIM_STATS is defined to 0, 
+    // termination, iterations and final_error are always filled.
+    struct RunStats {
+        ResultInfo termination = MaxIterationReached;
+        int iterations = 0;
+        int residual_evaluations = 0; // excluding those made for finite differences
+        int jacobian_evaluations = 0; // Jacobians, gradients or J^T J computed, numerically or by the problem
+        int hessian_evaluations = 0;
+        int fallbacks = 0; // linear solves that needed regularization or an orthogonal decomposition
+        Scalar final_error = std::numeric_limits<Scalar>::quiet_NaN(); // last evaluated error, the best one when stopped
+        Scalar gradient_norm = std::numeric_limits<Scalar>::quiet_NaN(); // norm of the gradient of the error at the last Jacobian
+        Clock::duration total_time{0};
+        Clock::duration residual_time{0};
+        Clock::duration jacobian_time{0};
+        Clock::duration solve_time{0};
+    };
+
+    // Adds the time spent until the end of the scope to a phase of RunStats, does nothing when statistics are disabled
+    class ScopedTimer {
+#if NON_LIN_OPTIM_STATS
+    private:
+        Clock::duration& phase;
+        const Clock::time_point start = Clock::now();
+    public:
+        explicit ScopedTimer(Clock::duration& phase) : phase(phase) {}
+        ~ScopedTimer(){ phase += Clock::now()-start; }
+#else
+    public:
+        explicit ScopedTimer(Clock::duration&) {}
+#endif
+        ScopedTimer(const ScopedTimer&) = delete;
+        ScopedTimer& operator=(const ScopedTimer&) = delete;
+    };
+
+    struct AsyncResult {
+        ResultInfo info;
+        Vector x;
+        RunStats stats;
     };
 
     inline
@@ -24,9 +91,31 @@ namespace non_lin_optim {
             PROCESS_VAL(Converged);     
             PROCESS_VAL(MaxIterationReached);
             PROCESS_VAL(TolleranceReached);
+            PROCESS_VAL(Stopped);
+            PROCESS_VAL(DeadlineReached);
         }
         #undef PROCESS_VAL
         return out << s;
 }
 
+    inline
+    std::ostream& operator<<(std::ostream& out, const RunStats& stats){
+        auto ms = [](const Clock::duration d){ return std::chrono::duration<double, std::milli>(d).count(); };
+        out << "termination:          " << stats.termination << "\n"
+            << "iterations:           " << stats.iterations << "\n"
+            << "final error:          " << stats.final_error << "\n";
+        if constexpr (collect_stats){
+            out << "gradient norm:        " << stats.gradient_norm << "\n"
+                << "residual evaluations: " << stats.residual_evaluations << "\n"
+                << "jacobian evaluations: " << stats.jacobian_evaluations << "\n"
+                << "hessian evaluations:  " << stats.hessian_evaluations << "\n"
+                << "solver fallbacks:     " << stats.fallbacks << "\n"
+                << "total time:           " << ms(stats.total_time) << " ms\n"
+                << "  residuals:          " << ms(stats.residual_time) << " ms\n"
+                << "  jacobians:          " << ms(stats.jacobian_time) << " ms\n"
+                << "  linear solves:      " << ms(stats.solve_time) << " ms\n";
+        }
+        return out;
+    }
+
 } // end namespace non_lin_optim
\ No newline at end of file
@@ -0,0 +1,126 @@
+#include <doctest/doctest.h>
+
+#include <non_lin_optim/io.h>
+#include <non_lin_optim/version.h>
+
+#include "temp_path.h"
+
+#include <filesystem>
+#include <fstream>
+
+using namespace non_lin_optim;
+
+constexpr double precision = 1e-12;
+
+TEST_CASE("BAL conversion and mapping") {
+
+    const std::string bal_path = temp_path("test_bal.txt");
+    const std::string path = temp_path("test_bal.bin");
+
+    {
+        std::ofstream bal(bal_path);
+        bal << "2 3 4\n"
+            << "0 0 -3.859900e+02 3.871200e+02\n"
+            << "1 0 -3.844000e+01 4.921200e+02\n"
+            << "0 1 -6.679200e+02 1.231100e+02\n"
+            << "1 2 5.0 -6.0\n";
+        for(int i=0; i<2*9+3*3; ++i)
+            bal << 0.5*i << "\n";
+    }
+
+    auto header = io::convert_bal(bal_path, path);
+    CHECK(header.num_cameras == 2);
+    CHECK(header.num_points == 3);
+    CHECK(header.num_observations == 4);
+
+    {
+        io::MappedProblem problem(path);
+        CHECK(problem.info().num_parameters() == 27);
+
+        auto indices = problem.indices();
+        CHECK(indices.cols() == 4);
+        CHECK(indices(0, 1) == 1);
+        CHECK(indices(1, 2) == 1);
+        CHECK(indices(1, 3) == 2);
+
+        auto observations = problem.observations();
+        CHECK(observations.rows() == 2);
+        CHECK(observations.cols() == 4);
+        CHECK(observations(0, 0) == doctest::Approx(-385.99).epsilon(precision));
+        CHECK(observations(1, 3) == doctest::Approx(-6.0).epsilon(precision));
+
+        CHECK(problem.camera(1)(0) == doctest::Approx(4.5).epsilon(precision));
+        CHECK(problem.point(2)(2) == doctest::Approx(13.0).epsilon(precision));
+
+        // parameters are mapped copy-on-write
+        problem.parameters()(0) = 42;
+        CHECK(problem.camera(0)(0) == doctest::Approx(42).epsilon(precision));
+    }
+
+    io::MappedProblem problem(path);
+    CHECK(problem.parameters()(0) == doctest::Approx(0).epsilon(precision));
+
+    std::ofstream(bal_path) << "1 1 2\n0 0 1.0 2.0\n";
+    CHECK_THROWS(io::convert_bal(bal_path, path));
+    CHECK_THROWS(io::MappedProblem(bal_path));
+
+    std::filesystem::remove(bal_path);
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Mapping a corrupt header") {
+
+    const std::string path = temp_path("test_header.bin");
+
+    // header followed by enough bytes for any valid layout of a few observations
+    auto write = [&](const io::ProblemHeader& header){
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        const std::vector<char> padding(1024, 0);
+        out.write(padding.data(), padding.size());
+    };
+
+    io::ProblemHeader header;
+    header.num_cameras = 1;
+    header.num_points = 2;
+    header.num_observations = 3;
+    write(header);
+    CHECK_NOTHROW(io::MappedProblem(path));
+
+    io::ProblemHeader negative = header;
+    negative.num_observations = -3;
+    write(negative);
+    CHECK_THROWS(io::MappedProblem(path));
+
+    negative = header;
+    negative.camera_size = -9;
+    write(negative);
+    CHECK_THROWS(io::MappedProblem(path));
+
+    // products wrapping around int64 to small sizes
+    io::ProblemHeader overflow = header;
+    overflow.num_observations = int64_t(1) << 62;
+    write(overflow);
+    CHECK_THROWS(io::MappedProblem(path));
+
+    overflow = header;
+    overflow.num_points = int64_t(1) << 61;
+    overflow.point_size = 8;
+    write(overflow);
+    CHECK_THROWS(io::MappedProblem(path));
+
+    overflow = header;
+    overflow.num_cameras = std::numeric_limits<int64_t>::max();
+    overflow.camera_size = 0;
+    overflow.num_points = std::numeric_limits<int64_t>::max();
+    overflow.point_size = 1;
+    write(overflow);
+    CHECK_THROWS(io::MappedProblem(path));
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Version") {
+    static_assert(std::string_view(NON_LIN_OPTIM_VERSION) == std::string_view("1.0"));
+    CHECK(std::string(NON_LIN_OPTIM_VERSION) == std::string("1.0"));
+}
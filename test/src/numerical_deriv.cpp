@@ -178,6 +178,208 @@ TEST_CASE("Case Jacobian vector 3") {
     CHECK(J(0,2) == doctest::Approx(0.0).epsilon(precision_jacobian));
 }
 
+TEST_CASE("Case normal equations by chunks") {
+
+    const int num_chunks = 7;
+    const int chunk_size = 5;
+    Vector t(num_chunks*chunk_size);
+    for(int i=0; i<t.size(); ++i)
+        t(i) = (Scalar)i/t.size();
+
+    auto func = [&](const Vector& x) -> Vector {
+        Vector r(t.size());
+        for(int i=0; i<t.size(); ++i)
+            r(i) = pow(x(0)*t(i)-0.2, 2) + sin(x(1)*t(i)) - x(2);
+        return r;
+    };
+
+    auto func_chunk = [&](const Vector& x, const int chunk) -> Vector {
+        return func(x).segment(chunk*chunk_size, chunk_size);
+    };
+
+    Vector x(3);
+    x(0) = 0.2;
+    x(1) = 0.3;
+    x(2) = -0.4;
+
+    Vector r = func(x);
+    Matrix J = numerical_deriv::JacobianApproxCentral(func, x);
+    Matrix JtJ_gt = J.transpose()*J;
+    Vector Jtr_gt = J.transpose()*r;
+
+    // J^T r and J d without forming J
+    CHECK((numerical_deriv::GradientApproxCentral(func, x, r)-Jtr_gt).cwiseAbs().maxCoeff() == doctest::Approx(0).epsilon(precision_jacobian));
+    CHECK(x(1) == doctest::Approx(0.3).epsilon(precision));
+    Vector d(3);
+    d << 1.0, -2.0, 0.5;
+    CHECK((numerical_deriv::JacobianProductCentral(func, x, d)-J*d).cwiseAbs().maxCoeff() == doctest::Approx(0).epsilon(precision_jacobian));
+
+    parallel::ThreadPool pool(3);
+    for(parallel::ThreadPool* p:{(parallel::ThreadPool*)nullptr, &pool}){
+        Matrix JtJ;
+        Vector Jtr;
+        Scalar error = numerical_deriv::NormalEquationsApprox(func_chunk, num_chunks, x, JtJ, Jtr, p);
+
+        CHECK(error == doctest::Approx(r.squaredNorm()).epsilon(precision));
+        CHECK(JtJ.rows() == 3);
+        CHECK(JtJ.cols() == 3);
+        CHECK((JtJ-JtJ_gt).cwiseAbs().maxCoeff() == doctest::Approx(0).epsilon(precision_jacobian));
+        CHECK((Jtr-Jtr_gt).cwiseAbs().maxCoeff() == doctest::Approx(0).epsilon(precision_jacobian));
+        CHECK((JtJ-JtJ.transpose()).cwiseAbs().maxCoeff() == 0);
+    }
+}
+
+TEST_CASE("Case batched Jacobian & Hessian") {
+
+    Vector t = Vector::LinSpaced(8, 0, 1);
+
+    auto func = [&](const Vector& x) -> Vector {
+        Vector r(t.size());
+        for(int i=0; i<t.size(); ++i)
+            r(i) = pow(x(0)*t(i)-0.2, 2) + sin(x(1)*t(i)) - x(2);
+        return r;
+    };
+    auto func_s = [&](const Vector& x) -> Scalar {
+        return 1-(pow(x(0)*(-0.5)-0.2, 2) + pow(x(1)-0.4, 4))/(0.1+x(0)*x(1)) + x(2)*x(0);
+    };
+
+    int calls = 0;
+    auto batch = [&](const Matrix& X) -> Matrix {
+        ++calls;
+        Matrix R(t.size(), X.cols());
+        for(int c=0; c<X.cols(); ++c)
+            R.col(c) = func(X.col(c));
+        return R;
+    };
+    auto batch_s = [&](const Matrix& X) -> Vector {
+        ++calls;
+        Vector f(X.cols());
+        for(int c=0; c<X.cols(); ++c)
+            f(c) = func_s(X.col(c));
+        return f;
+    };
+
+    Vector x(3);
+    x(0) = 0.2;
+    x(1) = 0.3;
+    x(2) = -0.4;
+
+    Matrix J = numerical_deriv::JacobianApprox(func, x);
+    Matrix J_batch = numerical_deriv::JacobianApproxBatch(batch, x);
+    CHECK(calls == 1);
+    CHECK(J_batch.rows() == t.size());
+    CHECK(J_batch.cols() == 3);
+    CHECK((J-J_batch).cwiseAbs().maxCoeff() == doctest::Approx(0).epsilon(precision_jacobian));
+
+    J = numerical_deriv::JacobianApproxCentral(func, x);
+    J_batch = numerical_deriv::JacobianApproxCentralBatch(batch, x);
+    CHECK(calls == 2);
+    CHECK((J-J_batch).cwiseAbs().maxCoeff() == doctest::Approx(0).epsilon(precision_jacobian));
+
+    Matrix g = numerical_deriv::JacobianApprox(func_s, x);
+    Vector g_batch = numerical_deriv::GradientApproxBatch(batch_s, x);
+    CHECK(calls == 3);
+    CHECK((g-g_batch).cwiseAbs().maxCoeff() == doctest::Approx(0).epsilon(precision_jacobian));
+
+    Matrix H = numerical_deriv::HessianApprox(func_s, x, 1e-4);
+    Matrix H_batch = numerical_deriv::HessianApproxBatch(batch_s, x, 1e-4);
+    CHECK(calls == 4);
+    CHECK((H-H_batch).cwiseAbs().maxCoeff() == doctest::Approx(0).epsilon(precision_hessian));
+    CHECK(H_batch(0,2) == doctest::Approx(1).epsilon(precision_hessian));
+    CHECK((H_batch-H_batch.transpose()).cwiseAbs().maxCoeff() == 0);
+
+    CHECK_THROWS(numerical_deriv::JacobianApproxBatch([](const Matrix& X) -> Matrix { return X.leftCols(1); }, x));
+}
+
+TEST_CASE("Case adaptive Jacobian") {
+
+    Vector t = Vector::LinSpaced(5, 0.1, 1);
+
+    // linear in x(0), oscillating in x(1), parameters of magnitude 0.3 to 12
+    auto func = [&](const Vector& x) -> Vector {
+        return 3*x(0)*t.array() + (50*x(1)*t.array()).sin()*x(2) + (x(2)*t.array()).exp()*1e-3*x(3)*x(3);
+    };
+    auto jacobian = [&](const Vector& x) -> Matrix {
+        Matrix J(5, 4);
+        J.col(0) = 3*t;
+        J.col(1) = 50*t.array()*(50*x(1)*t.array()).cos()*x(2);
+        J.col(2) = (50*x(1)*t.array()).sin() + t.array()*(x(2)*t.array()).exp()*1e-3*x(3)*x(3);
+        J.col(3) = (x(2)*t.array()).exp()*2e-3*x(3);
+        return J;
+    };
+
+    Vector x(4);
+    x << 12.0, 0.3, 0.7, 10;
+    const Matrix J_gt = jacobian(x);
+
+    CHECK(numerical_deriv::RelativeSteps(x, 1e-6)(0) == doctest::Approx(1.2e-5));
+    CHECK(numerical_deriv::RelativeSteps(x, 1e-6)(1) == doctest::Approx(1e-6));
+    Matrix J = numerical_deriv::JacobianApprox(func, x, numerical_deriv::RelativeSteps(x, 1e-8));
+    CHECK((J-J_gt).cwiseAbs().maxCoeff() < precision_jacobian);
+    J = numerical_deriv::JacobianApproxCentral(func, x, numerical_deriv::RelativeSteps(x, 1e-5));
+    CHECK((J-J_gt).cwiseAbs().maxCoeff() < precision_jacobian);
+    CHECK(x(0) == 12.0);
+
+    const Scalar tolerance = 1e-6;
+    numerical_deriv::AdaptiveJacobian adaptive(tolerance);
+    for(int call=0; call<2; ++call){
+        const int64_t evaluations = adaptive.evaluations();
+        J = adaptive(func, x);
+
+        // every column is extrapolated at first and the forward, then central, differences are measured against it
+        // until one is accurate enough, the cheapest sufficient scheme is used afterwards
+        if(call==0){
+            int64_t tried = 0;
+            for(const auto scheme:adaptive.schemes())
+                tried += scheme==numerical_deriv::Scheme::Forward ? 1 : 3;
+            CHECK(adaptive.evaluations()-evaluations == 1+4*x.size()+tried);
+        }
+        else CHECK(adaptive.evaluations()-evaluations < 2*x.size());
+        for(int i=0; i<x.size(); ++i){
+            const Scalar bound = tolerance*std::max(J_gt.col(i).cwiseAbs().maxCoeff(), 1.0);
+            CHECK((J-J_gt).col(i).cwiseAbs().maxCoeff() <= bound);
+            if(call>0) CHECK(adaptive.errors()(i) <= bound);
+        }
+    }
+    CHECK(adaptive.schemes()[0] == numerical_deriv::Scheme::Forward);
+    CHECK(adaptive.schemes()[2] == numerical_deriv::Scheme::Central);
+    CHECK(x(0) == 12.0);
+}
+
+TEST_CASE("Case adaptive Jacobian - Residuals of data with a large offset") {
+
+    // at the solution the residuals vanish but each is the difference of values near 1e4
+    Vector t = Vector::LinSpaced(20, 0, 1);
+    Vector x_s(2);
+    x_s << 10, 3;
+    auto model = [&](const Vector& x) -> Vector {
+        return (1e4 + x(0)*t.array() + (x(1)*t.array()).sin()).matrix();
+    };
+    const Vector y = model(x_s);
+    auto func = [&](const Vector& x) -> Vector { return model(x)-y; };
+
+    Matrix J_gt(20, 2);
+    J_gt.col(0) = t;
+    J_gt.col(1) = t.array()*(x_s(1)*t.array()).cos();
+
+    const Scalar tolerance = 1e-6;
+    numerical_deriv::AdaptiveJacobian adaptive(tolerance);
+    Vector x = x_s;
+    const Matrix J_central = numerical_deriv::JacobianApproxCentral(func, x, numerical_deriv::RelativeSteps(x, 1e-5));
+    for(int call=0; call<3; ++call){
+        const Matrix J = adaptive(func, x);
+        for(int i=0; i<x.size(); ++i){
+            const Scalar bound = tolerance*std::max(J_gt.col(i).cwiseAbs().maxCoeff(), 1.0);
+            CHECK((J-J_gt).col(i).cwiseAbs().maxCoeff() <= bound);
+            CHECK((J-J_central).col(i).cwiseAbs().maxCoeff() <= 2*bound);
+            CHECK(adaptive.errors()(i) <= bound);
+        }
+    }
+    // forward differences would be dominated by the rounding of the residuals
+    CHECK(adaptive.schemes()[0] != numerical_deriv::Scheme::Forward);
+    CHECK(adaptive.schemes()[1] != numerical_deriv::Scheme::Forward);
+}
+
 TEST_CASE("Version") {
     static_assert(std::string_view(NON_LIN_OPTIM_VERSION) == std::string_view("1.0"));
     CHECK(std::string(NON_LIN_OPTIM_VERSION) == std::string("1.0"));
@@ -4,7 +4,17 @@
 #include <non_lin_optim/types.h>
 #include <non_lin_optim/version.h>
 
+#include "temp_path.h"
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
 #include <iostream>
+#include <mutex>
+#include <random>
+#include <set>
+#include <sstream>
+#include <thread>
 
 using namespace non_lin_optim;
 
@@ -221,6 +231,898 @@ TEST_CASE("Case gaussian - Newton") {
     CHECK(x(1) == doctest::Approx(x_gt(1)).epsilon(precision));
 }
 
+TEST_CASE("Case Bivariate Gaussian - Stop and deadline") {
+
+    Vector x_gt(2); 
+    x_gt(0) = 1.4;
+    x_gt(1) = -3.5;    
+    
+    Vector x0(2); 
+    x0(0) = 1.0;
+    x0(1) = -2.0; 
+    
+    Scalar sigma = 2;
+    
+    auto func = [&](const Vector& x) -> Vector {
+        Vector y_hat(1);
+        y_hat(0) = 1-exp((pow(x(0)-x_gt(0),2)+pow(x(1)-x_gt(1),2))/sigma);
+        return y_hat;
+    };    
+    
+    auto optimizer = optim::GradientDescent(func, 10000, 1e-12, 0.1);
+
+    std::stop_source source;
+    source.request_stop();
+    Vector x = x0;
+    CHECK(optimizer.run(x, source.get_token(), Clock::time_point::max()) == Stopped);
+    CHECK(x(0) == doctest::Approx(x0(0)).epsilon(precision));
+    CHECK(x(1) == doctest::Approx(x0(1)).epsilon(precision));
+
+    x = x0;
+    CHECK(optimizer.run(x, std::stop_token(), Clock::now()) == DeadlineReached);
+    CHECK(x(0) == doctest::Approx(x0(0)).epsilon(precision));
+}
+
+TEST_CASE("Case Bivariate Gaussian - Asynchronous run") {
+
+    Vector x_gt(2); 
+    x_gt(0) = 1.4;
+    x_gt(1) = -3.5;    
+    
+    Vector x0(2); 
+    x0(0) = 1.0;
+    x0(1) = -2.0; 
+    
+    Scalar sigma = 2;
+    
+    auto func = [&](const Vector& x) -> Vector {
+        Vector y_hat(1);
+        y_hat(0) = 1-exp((pow(x(0)-x_gt(0),2)+pow(x(1)-x_gt(1),2))/sigma);
+        return y_hat;
+    };    
+    
+    auto optimizer = optim::GaussianNewton(func, 10000, 1e-12, 1);
+    auto result = optimizer.run_async(x0).get();
+
+    CHECK(result.info != Stopped);
+    CHECK(result.x(0) == doctest::Approx(x_gt(0)).epsilon(precision));
+    CHECK(result.x(1) == doctest::Approx(x_gt(1)).epsilon(precision));
+
+    std::stop_source source;
+    Scalar best_error = std::numeric_limits<Scalar>::max();
+    int last_iter = -1;
+    auto progress = [&](const int iter, const Scalar error, const Vector&) {
+        best_error = std::min(best_error, error);
+        last_iter = iter;
+        if(iter==3) source.request_stop();
+    };
+    auto optimizer_gd = optim::GradientDescent(func, 10000, 1e-12, 0.1);
+    result = optimizer_gd.run_async(x0, source.get_token(), Clock::time_point::max(), progress).get();
+
+    CHECK(result.info == Stopped);
+    CHECK(last_iter == 3);
+    CHECK(pow(func(result.x).norm(), 2) == doctest::Approx(best_error).epsilon(precision));
+}
+
+TEST_CASE("Case gaussian - Gaussian Newton warm start") {
+            
+    Vector t(10);
+    for(int i=0; i<10; ++i)
+        t(i) = (float)i/10;
+    
+    auto func = [&](const Vector& x) -> Vector {
+        Vector y_hat(10);
+        for(int i=0; i<t.size(); ++i){
+            y_hat(i) = pow(x(0)*t(i)-0.2, 2) + pow(x(1)-0.9, 4);
+        }
+        return y_hat;
+    };  
+
+    Vector x_gt(2);
+    x_gt(0) = 0.2;   
+    x_gt(1) = 0.3;
+    Vector y = func(x_gt);
+    
+    int evaluations = 0;
+    auto func_residuals = [&](const Vector& x) -> Vector {
+        evaluations++;
+        Vector y_hat = func(x);
+        return y_hat-y;
+    };    
+    
+    Vector x(2); 
+    x(0) = 0.0; 
+    x(1) = 0.1; 
+    
+    auto optimizer = optim::GaussianNewton(func_residuals, 10000, 1e-12, 1);
+    optimizer.set_warm_start(true);
+    optimizer.run(x);
+    
+    CHECK(x(0) == doctest::Approx(x_gt(0)).epsilon(precision));
+    CHECK(x(1) == doctest::Approx(x_gt(1)).epsilon(precision));
+
+    // next "frame": the observations move slightly
+    x_gt(0) = 0.21;
+    y = func(x_gt);
+
+    Vector x_cold = x;
+    auto optimizer_cold = optim::GaussianNewton(func_residuals, 10000, 1e-12, 1);
+    evaluations = 0;
+    optimizer_cold.run(x_cold);
+    int evaluations_cold = evaluations;
+
+    evaluations = 0;
+    optimizer.run(x);
+    
+    CHECK(x(0) == doctest::Approx(x_gt(0)).epsilon(precision));
+    CHECK(x(1) == doctest::Approx(x_cold(1)).epsilon(precision));
+    CHECK(evaluations < evaluations_cold);
+
+    // only a few observations change, patch them without re-evaluating the residuals
+    y(3) += 1e-3;
+    Vector values(1);
+    values(0) = (func(x)-y)(3);
+    optimizer.update_residuals({3}, values);
+    CHECK_THROWS(optimizer.update_residuals({10}, values));
+    CHECK_THROWS(optimizer.update_residuals({-1}, values));
+    evaluations = 0;
+    const ResultInfo info = optimizer.run(x);
+    // the first iteration neither evaluates the residuals nor the Jacobian, each other one evaluates the residuals
+    // once and, but the last, the central differences 2*2+1 times
+    const int iterations = optimizer.statistics().iterations;
+    REQUIRE(info != MaxIterationReached);
+    REQUIRE(iterations >= 2);
+    CHECK(evaluations == (iterations-1) + 5*(iterations-2));
+    CHECK((func(x)-y).norm() < 1e-3);
+}
+
+TEST_CASE("Case gaussian - Chunked Gaussian Newton") {
+            
+    const int num_chunks = 10;
+    const int chunk_size = 100;
+    Vector t(num_chunks*chunk_size);
+    for(int i=0; i<t.size(); ++i)
+        t(i) = (Scalar)i/t.size();
+
+    Vector x_gt(2);
+    x_gt(0) = 0.2;   
+    x_gt(1) = 0.3;
+
+    auto func = [&](const Vector& x, const int chunk) -> Vector {
+        Vector y_hat(chunk_size);
+        for(int i=0; i<chunk_size; ++i){
+            Scalar ti = t(chunk*chunk_size+i);
+            y_hat(i) = pow(x(0)*ti-0.2, 2) + pow(x(1)-0.9, 4);
+        }
+        return y_hat;
+    };  
+
+    std::vector<Vector> y;
+    for(int c=0; c<num_chunks; ++c)
+        y.push_back(func(x_gt, c));
+            
+    std::atomic<int> evaluations_chunk0 = 0;
+    auto func_residuals = [&](const Vector& x, const int chunk) -> Vector {
+        if(chunk==0) evaluations_chunk0++;
+        return func(x, chunk)-y[chunk];
+    };    
+    
+    for(int threads:{1, 3}){
+        Vector x(2); 
+        x(0) = 0.0; 
+        x(1) = 0.1; 
+        
+        auto optimizer = optim::ChunkedGaussianNewton(func_residuals, num_chunks, 10000, 1e-12, 1, threads);
+        evaluations_chunk0 = 0;
+        optimizer.run(x);
+        
+        CHECK(x(0) == doctest::Approx(x_gt(0)).epsilon(precision));
+        CHECK(x(1) == doctest::Approx(x_gt(1)).epsilon(precision));
+        // each chunk is evaluated once per iteration and twice per parameter for its Jacobian
+        CHECK(evaluations_chunk0 == (1+2*x.size())*optimizer.statistics().iterations);
+    }
+}
+
+TEST_CASE("Case Rosenbrock - Dogleg") {
+
+    auto func = [&](const Vector& x) -> Vector {
+        Vector r(2);
+        r(0) = 10*(x(1)-x(0)*x(0));
+        r(1) = 1-x(0);
+        return r;
+    };
+
+    Vector x(2); 
+    x(0) = -1.2;
+    x(1) = 1.0;
+
+    auto optimizer = optim::Dogleg(func, 1000, 1e-20, 1);
+    optimizer.run(x);
+
+    CHECK(x(0) == doctest::Approx(1.0).epsilon(precision));
+    CHECK(x(1) == doctest::Approx(1.0).epsilon(precision));
+
+    // a second run starts again from the initial trust radius
+    const Vector x_first = x;
+    const int iterations = optimizer.statistics().iterations;
+    x << -1.2, 1.0;
+    optimizer.run(x);
+    CHECK(x == x_first);
+    CHECK(optimizer.statistics().iterations == iterations);
+}
+
+TEST_CASE("Case gaussian - Dogleg") {
+            
+    Vector t(10);
+    for(int i=0; i<10; ++i)
+        t(i) = (float)i/10;
+    
+    auto func = [&](const Vector& x) -> Vector {
+        Vector y_hat(10);
+        for(int i=0; i<t.size(); ++i){
+            y_hat(i) = pow(x(0)*t(i)-0.2, 2) + pow(x(1)-0.9, 4);
+        }
+        return y_hat;
+    };  
+
+    Vector x_gt(2);
+    x_gt(0) = 0.2;   
+    x_gt(1) = 0.3;
+    Vector y = func(x_gt);
+            
+    auto func_residuals = [&](const Vector& x) -> Vector {
+        Vector y_hat = func(x);
+        return y_hat-y;
+    };    
+    
+    Vector x(2); 
+    x(0) = 0.0; 
+    x(1) = 0.1; 
+    
+    auto optimizer = optim::Dogleg(func_residuals, 10000, 1e-12, 1);
+    optimizer.run(x);
+    
+    CHECK(x(0) == doctest::Approx(x_gt(0)).epsilon(precision));
+    CHECK(x(1) == doctest::Approx(x_gt(1)).epsilon(precision));
+}
+
+TEST_CASE("Case discontinuous - Stalled steps") {
+
+    // the linearization at x0 is exact but every other point is much worse, so every step is rejected
+    const Scalar x0 = 0.5;
+    const Scalar x0_step = x0+1e-6; // forward point of the central differences at x0
+    int differences = 0;
+    auto func = [&](const Vector& x) -> Vector {
+        if(x(0)==x0_step) differences++;
+        Vector r(1);
+        r(0) = x(0) + (x(0)==x0 ? 0 : 10);
+        return r;
+    };
+
+    Vector x(1);
+    x(0) = x0;
+    auto optimizer = optim::Dogleg(func, 50, 1e-12, 1, 3);
+    CHECK(optimizer.run(x) == MaxIterationReached);
+    CHECK(x(0) == x0);
+    // the Jacobian at x0 is differenced once for the whole run
+    CHECK(differences == 1);
+
+    // a line search never meeting the Armijo condition leaves x unchanged
+    for(auto update:{optim::FletcherReeves, optim::PolakRibierePlus}){
+        x(0) = x0;
+        auto cg = optim::ConjugateGradient(func, 5, 1e-12, update);
+        CHECK(cg.run(x) == MaxIterationReached);
+        CHECK(x(0) == x0);
+    }
+}
+
+TEST_CASE("Case ill-conditioned - Conjugate gradient and Nesterov") {
+
+    // residual scales from 1 to 16 plus a weak nonlinear coupling, minimum at x = 1
+    auto func = [&](const Vector& x) -> Vector {
+        Vector r(6);
+        for(int i=0; i<5; ++i)
+            r(i) = pow(2, i)*(x(i)-1);
+        r(5) = x(0)*x(1)-1;
+        return r;
+    };
+
+    Vector x0 = Vector::Zero(5);
+
+    int iterations = 0;
+    auto progress = [&](const int iter, const Scalar, const Vector&) { iterations = iter+1; };
+
+    Vector x = x0;
+    auto gd = optim::GradientDescent(func, 10000, 1e-12, 0.005);
+    gd.run(x, std::stop_token(), Clock::time_point::max(), progress);
+    const int iterations_gd = iterations;
+    CHECK(x(0) == doctest::Approx(1.0).epsilon(precision));
+
+    for(auto update:{optim::FletcherReeves, optim::PolakRibierePlus}){
+        x = x0;
+        auto cg = optim::ConjugateGradient(func, 10000, 1e-12, update);
+        cg.run(x, std::stop_token(), Clock::time_point::max(), progress);
+
+        CHECK((x-Vector::Ones(5)).cwiseAbs().maxCoeff() < precision);
+        CHECK(iterations < iterations_gd/10);
+    }
+
+    x = x0;
+    auto nesterov = optim::NesterovGradient(func, 10000, 1e-12, 0.005, 0.9);
+    nesterov.run(x, std::stop_token(), Clock::time_point::max(), progress);
+
+    CHECK((x-Vector::Ones(5)).cwiseAbs().maxCoeff() < precision);
+    CHECK(iterations < iterations_gd/5);
+}
+
+TEST_CASE("Case rank deficient - Gaussian Newton fallback") {
+
+    // only x0+x1 is observable, J^T J is singular at every iterate
+    auto func = [](const Vector& x) -> Vector {
+        Vector r(3);
+        r(0) = x(0)+x(1)-1;
+        r(1) = 2*(x(0)+x(1))-2;
+        r(2) = exp(x(0)+x(1))-exp(1.0);
+        return r;
+    };
+
+    Vector x = Vector::Zero(2);
+    optim::GaussianNewton gn(func, 100, 1e-16);
+    gn.run(x);
+    CHECK(x.allFinite());
+    CHECK(x(0)+x(1) == doctest::Approx(1).epsilon(precision));
+    if constexpr (collect_stats) CHECK(gn.statistics().fallbacks > 0);
+    else CHECK(gn.statistics().fallbacks == 0);
+
+    solvelin::FallbackOptions options;
+    options.regularize = false;
+    x = Vector::Zero(2);
+    optim::GaussianNewton gn_cod(func, 100, 1e-16, 1, options);
+    gn_cod.run(x);
+    CHECK(x(0)+x(1) == doctest::Approx(1).epsilon(precision));
+    // minimum norm steps from the origin stay on the diagonal
+    CHECK(x(0) == doctest::Approx(x(1)).epsilon(precision));
+    if constexpr (collect_stats) CHECK(gn_cod.statistics().fallbacks > 0);
+    else CHECK(gn_cod.statistics().fallbacks == 0);
+}
+
+TEST_CASE("Case indefinite Hessian - Newton fallback") {
+
+    // the Hessian diag(2, 12*x1^2-4) is indefinite at the start
+    auto func = [](const Vector& x) -> Scalar {
+        return pow(x(0), 2) + pow(x(1)*x(1)-1, 2);
+    };
+
+    Vector x(2);
+    x << 1.0, 0.3;
+    optim::Newton newton(func, 100, 1e-16);
+    CHECK_NOTHROW(newton.run(x));
+    CHECK(x.allFinite());
+    CHECK(x(0) == doctest::Approx(0).epsilon(precision));
+    if constexpr (collect_stats) CHECK(newton.statistics().fallbacks > 0);
+}
+
+TEST_CASE("Case exponential fit - Mixed precision Gaussian Newton") {
+
+    const int m = 40;
+    Vector t = Vector::LinSpaced(m, 0, 2);
+    Vector x_gt(4);
+    x_gt << 1.5, -0.8, 0.5, 0.3;
+
+    auto model = [&](const Vector& x) -> Vector {
+        return (x(0)*(x(1)*t.array()).exp() + x(2)*(x(3)*t.array()).cos()).matrix();
+    };
+    Vector y = model(x_gt);
+    auto func = [&](const Vector& x) -> Vector {
+        return model(x)-y;
+    };
+
+    Vector x0(4);
+    x0 << 1.2, -0.6, 0.6, 0.4;
+
+    Vector x = x0;
+    optim::GaussianNewton gn(func, 100, 1e-20);
+    gn.run(x);
+
+    Vector x_mixed = x0;
+    optim::GaussianNewton gn_mixed(func, 100, 1e-20);
+    gn_mixed.set_mixed_precision(true);
+    gn_mixed.run(x_mixed);
+
+    for(int i=0; i<4; ++i){
+        CHECK(x_mixed(i) == doctest::Approx(x_gt(i)).epsilon(precision));
+        CHECK(x_mixed(i) == doctest::Approx(x(i)).epsilon(1e-9));
+    }
+}
+
+TEST_CASE("Case exponential fit - Sketched Gaussian Newton") {
+
+    const int m = 400;
+    Vector t = Vector::LinSpaced(m, 0, 2);
+    Vector x_gt(4);
+    x_gt << 1.5, -0.8, 0.5, 0.3;
+
+    auto model = [&](const Vector& x) -> Vector {
+        return (x(0)*(x(1)*t.array()).exp() + x(2)*(x(3)*t.array()).cos()).matrix();
+    };
+    Vector y = model(x_gt) + 1e-3*Vector::Random(m);
+    auto func = [&](const Vector& x) -> Vector {
+        return model(x)-y;
+    };
+
+    Vector x0(4);
+    x0 << 1.2, -0.6, 0.6, 0.4;
+
+    Vector x = x0;
+    optim::GaussianNewton gn(func, 100, 1e-20);
+    gn.run(x);
+
+    Vector x_sketched = x0;
+    optim::GaussianNewton gn_sketched(func, 100, 1e-20);
+    gn_sketched.set_sketching(20);
+    gn_sketched.run(x_sketched);
+
+    CHECK(gn_sketched.statistics().fallbacks == 0);
+    for(int i=0; i<4; ++i)
+        CHECK(x_sketched(i) == doctest::Approx(x(i)).epsilon(1e-6));
+}
+
+TEST_CASE("Case exponential fit - Gaussian Newton with solver selection") {
+
+    const int m = 40;
+    Vector t = Vector::LinSpaced(m, 0, 2);
+    Vector x_gt(4);
+    x_gt << 1.5, -0.8, 0.5, 0.3;
+
+    // amplitudes in badly scaled units, the columns of J differ by 1e8 in norm but are independent
+    auto model = [&](const Vector& x) -> Vector {
+        return (1e-4*x(0)*(x(1)*t.array()).exp() + 1e4*x(2)*(x(3)*t.array()).cos()).matrix();
+    };
+    Vector x_scaled = x_gt;
+    x_scaled(0) *= 1e4;
+    x_scaled(2) *= 1e-4;
+    Vector y = model(x_scaled);
+    auto func = [&](const Vector& x) -> Vector {
+        return model(x)-y;
+    };
+
+    Vector x(4);
+    x << 1.2e4, -0.6, 0.6e-4, 0.4;
+    CHECK(solvelin::select(numerical_deriv::JacobianApproxCentral(func, x)) == solvelin::LeastSquares::NormalEquations);
+    optim::GaussianNewton gn(func, 100, 1e-20);
+    gn.set_solver_selection(true);
+    gn.run(x);
+
+    CHECK(gn.statistics().fallbacks == 0);
+    for(int i=0; i<4; ++i)
+        CHECK(x(i) == doctest::Approx(x_scaled(i)).epsilon(1e-8));
+
+    // two exponentials of close rates, their columns are nearly collinear and J^T J would square cond(J)
+    Vector z_gt(4);
+    z_gt << 1.0, -0.8, 0.5, -0.75;
+    auto model_close = [&](const Vector& z) -> Vector {
+        return (z(0)*(z(1)*t.array()).exp() + z(2)*(z(3)*t.array()).exp()).matrix();
+    };
+    Vector y_close = model_close(z_gt);
+    auto func_close = [&](const Vector& z) -> Vector {
+        return model_close(z)-y_close;
+    };
+
+    Vector z(4);
+    z << 0.9, -0.85, 0.6, -0.7;
+    CHECK(solvelin::select(numerical_deriv::JacobianApproxCentral(func_close, z)) == solvelin::LeastSquares::ColPivQR);
+    optim::GaussianNewton gn_close(func_close, 100, 1e-24);
+    gn_close.set_solver_selection(true);
+    gn_close.run(z);
+
+    CHECK(gn_close.statistics().fallbacks == 0);
+    for(int i=0; i<4; ++i)
+        CHECK(z(i) == doctest::Approx(z_gt(i)).epsilon(1e-8));
+}
+
+TEST_CASE("Case Bivariate Gaussian - Run statistics") {
+
+    Vector x_gt(2); 
+    x_gt(0) = 1.4;
+    x_gt(1) = -3.5;    
+    
+    Vector x0(2); 
+    x0(0) = 1.0;
+    x0(1) = -2.0; 
+    
+    Scalar sigma = 2;
+    
+    auto func = [&](const Vector& x) -> Vector {
+        Vector y_hat(1);
+        y_hat(0) = 1-exp((pow(x(0)-x_gt(0),2)+pow(x(1)-x_gt(1),2))/sigma);
+        return y_hat;
+    };    
+    
+    Vector x = x0;
+    auto gn = optim::GaussianNewton(func, 10000, 1e-12, 1);
+    const ResultInfo info = gn.run(x);
+    const RunStats& stats = gn.statistics();
+
+    CHECK(stats.termination == info);
+    CHECK(stats.iterations > 0);
+    CHECK(stats.final_error == doctest::Approx(pow(func(x).norm(), 2)));
+    CHECK(stats.total_time >= stats.residual_time+stats.jacobian_time+stats.solve_time);
+    if constexpr (collect_stats){
+        CHECK(stats.residual_evaluations >= stats.iterations);
+        CHECK(stats.jacobian_evaluations == stats.iterations-1);
+        CHECK(stats.gradient_norm < 1e-3);
+    }
+    else {
+        // only termination, iterations and final_error are filled
+        CHECK(stats.residual_evaluations == 0);
+        CHECK(stats.jacobian_evaluations == 0);
+        CHECK(stats.total_time == Clock::duration::zero());
+    }
+
+    // trial points of Dogleg are counted as residual evaluations
+    x = x0;
+    auto dogleg = optim::Dogleg(func, 10000, 1e-12);
+    dogleg.run(x);
+    if constexpr (collect_stats){
+        CHECK(dogleg.statistics().residual_evaluations >= dogleg.statistics().iterations);
+        CHECK(dogleg.statistics().jacobian_evaluations > 0);
+    }
+    else CHECK(dogleg.statistics().residual_evaluations == 0);
+
+    std::stop_source source;
+    source.request_stop();
+    auto gd = optim::GradientDescent(func, 10000, 1e-12, 0.1);
+    auto result = gd.run_async(x0, source.get_token()).get();
+    CHECK(result.stats.termination == Stopped);
+    CHECK(result.stats.iterations == 1);
+    CHECK(result.stats.jacobian_evaluations == 0);
+
+    std::ostringstream report;
+    report << stats;
+    CHECK(report.str().find("iterations") != std::string::npos);
+}
+
+TEST_CASE("Case ill-conditioned - Checkpoint and resume") {
+
+    auto func = [&](const Vector& x) -> Vector {
+        Vector r(6);
+        for(int i=0; i<5; ++i)
+            r(i) = pow(2, i)*(x(i)-1);
+        r(5) = x(0)*x(1)-1;
+        return r;
+    };
+
+    const Vector x0 = Vector::Zero(5);
+    const std::string path = temp_path("test_checkpoint.bin");
+
+    // a run preempted after 5 iterations and resumed from the checkpoint of iteration 3 ends like an uninterrupted one
+    auto check_resume = [&](auto make){
+        Vector x_ref = x0;
+        auto reference = make();
+        const ResultInfo info = reference.run(x_ref);
+
+        std::stop_source source;
+        auto progress = [&](const int iter, const Scalar, const Vector&) { if(iter==5) source.request_stop(); };
+        Vector x = x0;
+        auto preempted = make();
+        preempted.set_checkpoint(path, 3, 2);
+        CHECK(preempted.run(x, source.get_token(), Clock::time_point::max(), progress) == Stopped);
+
+        x = Vector::Zero(1);
+        auto resumed = make();
+        CHECK(resumed.resume(x, path) == info);
+        CHECK(x == x_ref);
+        CHECK(resumed.statistics().iterations == reference.statistics().iterations);
+        CHECK(resumed.statistics().residual_evaluations == reference.statistics().residual_evaluations);
+        CHECK(resumed.statistics().jacobian_evaluations == reference.statistics().jacobian_evaluations);
+        CHECK(resumed.statistics().final_error == reference.statistics().final_error);
+    };
+
+    check_resume([&]{ return optim::GaussianNewton(func, 10000, 1e-12, 0.5); });
+    check_resume([&]{ return optim::Dogleg(func, 10000, 1e-12, 0.1); });
+    check_resume([&]{ return optim::ConjugateGradient(func, 10000, 1e-12); });
+    check_resume([&]{ return optim::NesterovGradient(func, 10000, 1e-12, 0.005, 0.9); });
+    check_resume([&]{
+        auto gn = optim::GaussianNewton(func, 10000, 1e-12, 0.5);
+        gn.set_adaptive_jacobian(true);
+        return gn;
+    });
+
+    // the state of Gauss-Newton does not hold the velocity of Nesterov
+    Vector x = x0;
+    auto gn = optim::GaussianNewton(func, 10000, 1e-12, 0.5);
+    gn.set_checkpoint(path, 1);
+    gn.run(x);
+    auto nesterov = optim::NesterovGradient(func, 10000, 1e-12, 0.005, 0.9);
+    CHECK_THROWS(nesterov.resume(x, path));
+
+
+    // nor does it hold the schemes of an adaptive Jacobian
+    auto adaptive = optim::GaussianNewton(func, 10000, 1e-12, 0.5);
+    adaptive.set_adaptive_jacobian(true);
+    CHECK_THROWS(adaptive.resume(x, path));
+
+    // a new run differentiates from scratch, the schemes of the previous run are not reused
+    Vector x_first = x0;
+    adaptive.run(x_first);
+    const RunStats first = adaptive.statistics();
+    Vector x_second = x0;
+    adaptive.run(x_second);
+    CHECK(x_second == x_first);
+    CHECK(adaptive.statistics().iterations == first.iterations);
+
+    // bools are a single byte 0 or 1
+    checkpoint::Writer out;
+    out.put(true);
+    out.put(static_cast<unsigned char>(2));
+    checkpoint::Reader in(out.data());
+    CHECK(in.get<bool>());
+    CHECK_THROWS(in.get<bool>());
+
+    std::filesystem::remove(path);
+    CHECK_THROWS(gn.resume(x, path));
+}
+
+TEST_CASE("Case exponential fit - Variable projection") {
+
+    Vector t = Vector::LinSpaced(40, 0, 4);
+
+    // two decays and an offset, linear in their amplitudes
+    auto basis = [&](const Vector& a) -> Matrix {
+        Matrix Phi(t.size(), 3);
+        Phi.col(0) = (-a(0)*t).array().exp();
+        Phi.col(1) = (-a(1)*t).array().exp();
+        Phi.col(2).setOnes();
+        return Phi;
+    };
+
+    Vector a_gt(2);
+    a_gt << 1.3, 0.2;
+    Vector c_gt(3);
+    c_gt << 2, 0.5, 0.1;
+    const Vector y = basis(a_gt)*c_gt;
+
+    Vector a(2);
+    a << 1.0, 0.1;
+    auto varpro = optim::VariableProjection(basis, y, 1000, 1e-20);
+    varpro.run(a);
+
+    CHECK(a(0) == doctest::Approx(a_gt(0)).epsilon(precision));
+    CHECK(a(1) == doctest::Approx(a_gt(1)).epsilon(precision));
+    const Vector c = varpro.linear_parameters(a);
+    for(int i=0; i<3; ++i)
+        CHECK(c(i) == doctest::Approx(c_gt(i)).epsilon(precision));
+
+    // the same fit over all five parameters
+    auto func = [&](const Vector& x) -> Vector { return basis(x.tail(2))*x.head(3) - y; };
+    Vector x(5);
+    x << 1, 1, 1, 1.0, 0.1;
+    auto gn = optim::GaussianNewton(func, 1000, 1e-20);
+    gn.run(x);
+    CHECK(x(3) == doctest::Approx(a_gt(0)).epsilon(precision));
+    CHECK(varpro.statistics().iterations <= gn.statistics().iterations);
+
+    CHECK_THROWS(optim::VariableProjection(basis, Vector::Zero(3)).run(a));
+}
+
+// Optimizers taking a batch of residuals for their Jacobians
+template<typename Optimizer>
+concept accepts_batch = requires(Optimizer& optimizer, const Func_batch_v& batch){ optimizer.set_batch(batch); };
+
+// Optimizers differentiating their residuals with the adaptive Jacobian
+template<typename Optimizer>
+concept accepts_adaptive = requires(Optimizer& optimizer){ optimizer.set_adaptive_jacobian(true); };
+
+// Optimizers retrying steps, which they may try at once
+template<typename Optimizer>
+concept accepts_speculation = requires(Optimizer& optimizer){ optimizer.set_speculation(4); };
+
+TEST_CASE("Case gaussian - Batched residuals") {
+
+    Vector t(10);
+    for(int i=0; i<10; ++i)
+        t(i) = (float)i/10;
+
+    Vector x_gt(2);
+    x_gt(0) = 0.2;
+    x_gt(1) = 0.3;
+
+    // each column of X is a point, the residuals of all points are computed in one sweep over t
+    auto batch = [&](const Matrix& X) -> Matrix {
+        Matrix R(t.size(), X.cols());
+        for(int i=0; i<t.size(); ++i)
+            R.row(i) = ((X.row(0)*t(i)).array()-0.2).square() - pow(x_gt(0)*t(i)-0.2, 2)
+                     + (X.row(1).array()-0.9).pow(4) - pow(x_gt(1)-0.9, 4);
+        return R;
+    };
+    auto func = [&](const Vector& x) -> Vector { return batch(x); };
+
+    Vector x0(2);
+    x0(0) = 0.0;
+    x0(1) = 0.1;
+
+    Vector x_ref = x0;
+    auto reference = optim::GaussianNewton(func, 10000, 1e-12, 1);
+    reference.run(x_ref);
+
+    Vector x = x0;
+    auto gn = optim::GaussianNewton(func, 10000, 1e-12, 1);
+    gn.set_batch(batch);
+    gn.run(x);
+
+    CHECK(x(0) == doctest::Approx(x_gt(0)).epsilon(precision));
+    CHECK(x(1) == doctest::Approx(x_gt(1)).epsilon(precision));
+    CHECK((x-x_ref).cwiseAbs().maxCoeff() < 1e-8);
+
+    auto func_s = [&](const Vector& x) -> Scalar { return func(x).squaredNorm(); };
+    auto batch_s = [&](const Matrix& X) -> Vector { return batch(X).colwise().squaredNorm(); };
+    x = x0;
+    auto newton = optim::Newton(func_s, 100, 1e-12, 1);
+    newton.set_batch(batch_s);
+    newton.run(x);
+    CHECK(func_s(x) < func_s(x0)*1e-3);
+
+    static_assert(accepts_batch<optim::GaussianNewton> && accepts_batch<optim::Dogleg>);
+    static_assert(!accepts_batch<optim::VariableProjection> && !accepts_batch<optim::ChunkedGaussianNewton>);
+    static_assert(!accepts_batch<optim::SparseGaussianNewton> && !accepts_batch<optim::StochasticGradientDescent>);
+    static_assert(accepts_adaptive<optim::GaussianNewton> && accepts_adaptive<optim::NesterovGradient>);
+    static_assert(!accepts_adaptive<optim::Newton> && !accepts_adaptive<optim::ChunkedGaussianNewton>);
+    static_assert(!accepts_adaptive<optim::SparseGaussianNewton> && !accepts_adaptive<optim::StochasticGradientDescent>);
+}
+
+TEST_CASE("Case linear model - Stochastic gradient descent") {
+
+    const int m = 5000;
+    Vector t = Vector::LinSpaced(m, 0, 1);
+    Vector x_gt(3);
+    x_gt << 0.7, -1.2, 0.3;
+
+    auto model = [&](const Vector& x, const int i){ return x(0)*t(i) + x(1)*sin(3*t(i)) + x(2)*exp(-t(i)); };
+    auto func = [&](const Vector& x, const std::vector<int>& rows) -> Vector {
+        Vector r(rows.size());
+        for(size_t k=0; k<rows.size(); ++k)
+            r(k) = model(x, rows[k]) - model(x_gt, rows[k]);
+        return r;
+    };
+
+    // every row is drawn once per epoch
+    optim::BatchSampler sampler(10, 4, 1);
+    std::vector<int> seen;
+    for(int size:{4, 4, 2}){
+        auto rows = sampler.next();
+        CHECK(static_cast<int>(rows.size()) == size);
+        CHECK(std::is_sorted(rows.begin(), rows.end()));
+        seen.insert(seen.end(), rows.begin(), rows.end());
+    }
+    std::sort(seen.begin(), seen.end());
+    CHECK(seen == std::vector<int>({0, 1, 2, 3, 4, 5, 6, 7, 8, 9}));
+    CHECK(sampler.next().size() == 4);
+    CHECK(sampler.epoch() == 1);
+
+    Vector x = Vector::Zero(3);
+    auto momentum = optim::StochasticGradientDescent(func, m, 64, 2000, 1e-12, 1e-4, optim::Momentum);
+    std::atomic<int> prefetched = 0;
+    momentum.set_prefetch([&](const std::vector<int>& rows){
+        if(!rows.empty()) ++prefetched;
+    });
+    momentum.run(x);
+    CHECK((x-x_gt).cwiseAbs().maxCoeff() < precision);
+    CHECK(momentum.statistics().iterations < 1000);
+    CHECK(prefetched >= momentum.statistics().iterations);
+
+    x = Vector::Zero(3);
+    auto adam = optim::StochasticGradientDescent(func, m, 64, 2000, 1e-12, 0.03, optim::Adam);
+    adam.set_schedule(optim::schedule::cosine(2000, 0.01));
+    adam.run(x);
+    CHECK((x-x_gt).cwiseAbs().maxCoeff() < precision);
+
+    // with noisy data the error of a batch often falls below the minimum of the full error, it must neither stop
+    // the run nor be taken for the best iterate
+    std::mt19937 gen(0);
+    std::normal_distribution<Scalar> noise(0, 0.1);
+    Vector y(m);
+    Matrix A(m, 3);
+    for(int i=0; i<m; ++i){
+        A.row(i) << t(i), sin(3*t(i)), exp(-t(i));
+        y(i) = model(x_gt, i) + noise(gen);
+    }
+    const Vector x_ls = A.colPivHouseholderQr().solve(y);
+    const Scalar min_error = (A*x_ls-y).squaredNorm();
+    auto noisy = [&](const Vector& x, const std::vector<int>& rows) -> Vector {
+        Vector r(rows.size());
+        for(size_t k=0; k<rows.size(); ++k)
+            r(k) = model(x, rows[k]) - y(rows[k]);
+        return r;
+    };
+    x = Vector::Zero(3);
+    auto sgd = optim::StochasticGradientDescent(noisy, m, 8, 3000, 0.9*min_error, 0.03, optim::Adam);
+    sgd.set_schedule(optim::schedule::cosine(3000, 0.01));
+    sgd.set_evaluation_period(100);
+    const ResultInfo noisy_info = sgd.run(x);
+    CHECK(noisy_info != TolleranceReached);
+    CHECK(sgd.statistics().final_error >= min_error);
+    CHECK(sgd.statistics().final_error < 1.1*min_error);
+    CHECK((x-x_ls).cwiseAbs().maxCoeff() < 5e-2);
+
+    CHECK(optim::schedule::step_decay(0.5, 10)(25) == doctest::Approx(0.25));
+    CHECK(optim::schedule::inverse_time(0.1)(10) == doctest::Approx(0.5));
+    CHECK(optim::schedule::cosine(100)(100) == doctest::Approx(0));
+    CHECK_THROWS(optim::schedule::step_decay(0.5, 0));
+    CHECK_THROWS(optim::schedule::cosine(0));
+
+    // resuming restores the sampler and the moments
+    const std::string path = temp_path("test_sgd.bin");
+    Vector x_ref = Vector::Zero(3);
+    auto reference = optim::StochasticGradientDescent(func, m, 64, 40, 1e-12, 0.03, optim::Adam);
+    reference.run(x_ref);
+
+    std::stop_source source;
+    auto progress = [&](const int iter, const Scalar, const Vector&) { if(iter==25) source.request_stop(); };
+    x = Vector::Zero(3);
+    auto preempted = optim::StochasticGradientDescent(func, m, 64, 40, 1e-12, 0.03, optim::Adam);
+    preempted.set_checkpoint(path, 20);
+    preempted.run(x, source.get_token(), Clock::time_point::max(), progress);
+    auto resumed = optim::StochasticGradientDescent(func, m, 64, 40, 1e-12, 0.03, optim::Adam);
+    resumed.resume(x, path);
+    CHECK(x == x_ref);
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Case Rosenbrock - Speculative steps") {
+
+    std::mutex mutex;
+    std::set<std::thread::id> threads;
+    auto func = [&](const Vector& x) -> Vector {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            threads.insert(std::this_thread::get_id());
+        }
+        Vector r(2);
+        r(0) = 10*(x(1)-x(0)*x(0));
+        r(1) = 1-x(0);
+        return r;
+    };
+
+    Vector x0(2);
+    x0(0) = -1.2;
+    x0(1) = 1.0;
+
+    // a single candidate retries exactly like the sequential search
+    auto check_single = [&](auto make){
+        Vector x_ref = x0;
+        auto reference = make();
+        reference.run(x_ref);
+        Vector x = x0;
+        auto single = make();
+        single.set_speculation(1);
+        single.run(x);
+        CHECK(x == x_ref);
+    };
+    check_single([&]{ return optim::Dogleg(func, 1000, 1e-20, 10); });
+    check_single([&]{ return optim::ConjugateGradient(func, 10000, 1e-20); });
+
+    // a large initial radius is rejected several times in a row
+    Vector x = x0;
+    auto dogleg = optim::Dogleg(func, 1000, 1e-20, 10);
+    dogleg.set_speculation(4);
+    threads.clear();
+    dogleg.run(x);
+    CHECK(x(0) == doctest::Approx(1.0).epsilon(precision));
+    CHECK(x(1) == doctest::Approx(1.0).epsilon(precision));
+    CHECK(threads.size() > 1);
+
+    x = x0;
+    auto cg = optim::ConjugateGradient(func, 10000, 1e-20);
+    cg.set_speculation(4);
+    cg.run(x);
+    CHECK(x(0) == doctest::Approx(1.0).epsilon(precision));
+    CHECK(x(1) == doctest::Approx(1.0).epsilon(precision));
+
+    static_assert(accepts_speculation<optim::Dogleg> && accepts_speculation<optim::ConjugateGradient>);
+    static_assert(!accepts_speculation<optim::GaussianNewton> && !accepts_speculation<optim::NesterovGradient>);
+    static_assert(!accepts_speculation<optim::GradientDescent> && !accepts_speculation<optim::Newton>);
+}
+
 TEST_CASE("Version") {
     static_assert(std::string_view(NON_LIN_OPTIM_VERSION) == std::string_view("1.0"));
     CHECK(std::string(NON_LIN_OPTIM_VERSION) == std::string("1.0"));
@@ -0,0 +1,88 @@
+#include <doctest/doctest.h>
+
+#include <non_lin_optim/parallel.h>
+#include <non_lin_optim/version.h>
+
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace non_lin_optim;
+
+TEST_CASE("ThreadPool covers every index once") {
+
+    parallel::ThreadPool pool(4);
+    CHECK(pool.size() == 4);
+
+    for(int n:{0, 1, 7, 1000}){
+        std::vector<std::atomic<int>> counts(n);
+        std::atomic<bool> valid_worker = true;
+        pool.parallel_for(n, [&](const int worker, const int i){
+            if(worker<0 || worker>=pool.size()) valid_worker = false;
+            counts[i]++;
+        });
+        bool once = true;
+        for(auto& c:counts)
+            once = once && c==1;
+        CHECK(once);
+        CHECK(valid_worker);
+    }
+}
+
+TEST_CASE("ThreadPool nested calls and exceptions") {
+
+    parallel::ThreadPool pool(3);
+
+    std::atomic<int> total = 0;
+    pool.parallel_for(5, [&](const int, const int){
+        pool.parallel_for(4, [&](const int, const int){ total++; });
+    });
+    CHECK(total == 20);
+
+    CHECK_THROWS(pool.parallel_for(10, [](const int, const int i){
+        if(i==5) throw std::runtime_error("failure");
+    }));
+
+    total = 0;
+    pool.parallel_for(10, [&](const int, const int){ total++; });
+    CHECK(total == 10);
+
+    total = 0;
+    parallel::parallel_for(nullptr, 10, [&](const int worker, const int){ total += worker+1; });
+    CHECK(total == 10);
+}
+
+TEST_CASE("BackgroundWorker runs jobs on one thread") {
+
+    std::thread::id first;
+    std::atomic<int> total = 0;
+    std::atomic<bool> same_thread = true;
+    {
+        parallel::BackgroundWorker worker;
+        for(int i=0; i<10; ++i){
+            worker.submit([&]{
+                if(total==0) first = std::this_thread::get_id();
+                if(std::this_thread::get_id()!=first) same_thread = false;
+                total++;
+            });
+        }
+        worker.wait();
+        CHECK(total == 10);
+        CHECK(same_thread);
+        CHECK(first != std::this_thread::get_id());
+
+        worker.submit([]{ throw std::runtime_error("failure"); });
+        CHECK_THROWS(worker.wait());
+        worker.wait();
+
+        // the pending job runs before the worker is destroyed
+        worker.submit([&]{ total++; });
+    }
+    CHECK(total == 11);
+}
+
+TEST_CASE("Version") {
+    static_assert(std::string_view(NON_LIN_OPTIM_VERSION) == std::string_view("1.0"));
+    CHECK(std::string(NON_LIN_OPTIM_VERSION) == std::string("1.0"));
+}
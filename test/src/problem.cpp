@@ -0,0 +1,94 @@
+#include <doctest/doctest.h>
+
+#include <non_lin_optim/optim.h>
+#include <non_lin_optim/problem.h>
+#include <non_lin_optim/version.h>
+
+using namespace non_lin_optim;
+
+constexpr double precision = 1e-3;
+constexpr double precision_jacobian = 1e-4;
+
+// Each observation i depends on the shared parameters (a, b) and on its own offset c_i
+Problem make_problem(const Vector& t, const Vector& y, const int threads){
+    Problem problem(threads);
+    int shared = problem.add_parameter_block(2);
+    for(int i=0; i<t.size(); ++i){
+        int offset = problem.add_parameter_block(1);
+        Scalar ti = t(i);
+        Scalar yi = y(i);
+        problem.add_residual_block(2, [ti, yi](const Vector& p) -> Vector {
+            Vector r(2);
+            r(0) = p(0)*exp(p(1)*ti) + p(2) - yi;
+            r(1) = p(2) - 0.01*ti;
+            return r;
+        }, {shared, offset});
+    }
+    return problem;
+}
+
+TEST_CASE("Problem dense and sparse Jacobians") {
+
+    Vector t(20);
+    Vector y(20);
+    for(int i=0; i<t.size(); ++i){
+        t(i) = (Scalar)i/10;
+        y(i) = 0.5*exp(-1.2*t(i)) + 0.01*t(i);
+    }
+
+    for(int threads:{1, 4}){
+        Problem problem = make_problem(t, y, threads);
+        CHECK(problem.num_parameters() == 22);
+        CHECK(problem.num_residuals() == 40);
+        CHECK(problem.num_residual_blocks() == 20);
+
+        Vector x = Vector::Constant(22, 0.3);
+        Vector r = problem(x);
+        CHECK(r.size() == 40);
+
+        Func_v func = problem;
+        Matrix J_gt = numerical_deriv::JacobianApproxCentral(func, x);
+
+        Matrix J;
+        problem.jacobian(x, J);
+        CHECK((J-J_gt).cwiseAbs().maxCoeff() == doctest::Approx(0).epsilon(precision_jacobian));
+
+        SparseMatrix J_sparse;
+        problem.jacobian(x, J_sparse);
+        CHECK(J_sparse.nonZeros() == 20*2*3);
+        CHECK((Matrix(J_sparse)-J_gt).cwiseAbs().maxCoeff() == doctest::Approx(0).epsilon(precision_jacobian));
+    }
+
+    Problem problem;
+    int block = problem.add_parameter_block(1);
+    CHECK_THROWS(problem.add_parameter_block(0));
+    CHECK_THROWS(problem.add_residual_block(1, [](const Vector& p) -> Vector { return p; }, {block, block}));
+    CHECK_THROWS(problem.add_residual_block(1, [](const Vector& p) -> Vector { return p; }, {3}));
+}
+
+TEST_CASE("Problem - Sparse Gaussian Newton") {
+
+    Vector t(20);
+    Vector y(20);
+    for(int i=0; i<t.size(); ++i){
+        t(i) = (Scalar)i/10;
+        y(i) = 0.5*exp(-1.2*t(i)) + 0.01*t(i);
+    }
+
+    Problem problem = make_problem(t, y, 2);
+    Vector x = Vector::Zero(problem.num_parameters());
+    x(0) = 1;
+    x(1) = -1;
+
+    auto optimizer = optim::SparseGaussianNewton(problem, 1000, 1e-20, 1);
+    optimizer.run(x);
+
+    CHECK(x(0) == doctest::Approx(0.5).epsilon(precision));
+    CHECK(x(1) == doctest::Approx(-1.2).epsilon(precision));
+    CHECK(x(2+5) == doctest::Approx(0.005).epsilon(precision));
+}
+
+TEST_CASE("Version") {
+    static_assert(std::string_view(NON_LIN_OPTIM_VERSION) == std::string_view("1.0"));
+    CHECK(std::string(NON_LIN_OPTIM_VERSION) == std::string("1.0"));
+}
@@ -2,8 +2,12 @@
 
 #include <non_lin_optim/solvelin.h>
 #include <non_lin_optim/version.h>
+#include "temp_path.h"
 
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <optional>
 #include <Eigen/Dense>
 
 bool print = false;
@@ -138,6 +142,374 @@ TEST_CASE("Dynamic") {
     f(A, b, x, false);
 }
 
+template<typename T>
+void check_iterative(const T& A, const Eigen::VectorXd& b, const Eigen::VectorXd& x){
+    
+    using namespace solvelin::iterative;
+    
+    Eigen::VectorXd x_hat;
+    auto info = cg(A, b, x_hat);
+    CHECK(info.converged);
+    CHECK((x_hat-x).cwiseAbs().maxCoeff() == doctest::Approx(0).epsilon(0.0001));
+    if(print) std::cout << "cg iterations " << info.iterations << std::endl;
+    
+    // warm start from the solution
+    info = cg(A, b, x_hat);
+    CHECK(info.iterations == 0);
+    
+    x_hat.resize(0);
+    info = cg(A, b, x_hat, Jacobi<double>(A));
+    CHECK(info.converged);
+    CHECK((x_hat-x).cwiseAbs().maxCoeff() == doctest::Approx(0).epsilon(0.0001));
+    
+    x_hat.resize(0);
+    info = cg(A, b, x_hat, BlockJacobi<double>(A, 4), 1e-12);
+    CHECK(info.converged);
+    CHECK((x_hat-x).cwiseAbs().maxCoeff() == doctest::Approx(0).epsilon(0.0001));
+    
+    x_hat.resize(0);
+    info = cg(A, b, x_hat, IncompleteCholesky<double>(A));
+    CHECK(info.converged);
+    CHECK(info.iterations <= 2);
+    CHECK((x_hat-x).cwiseAbs().maxCoeff() == doctest::Approx(0).epsilon(0.0001));
+    
+    x_hat.resize(0);
+    info = minres(A, b, x_hat, Jacobi<double>(A));
+    CHECK(info.converged);
+    CHECK((x_hat-x).cwiseAbs().maxCoeff() == doctest::Approx(0).epsilon(0.0001));
+    
+    x_hat.resize(0);
+    info = lsqr(A, b, x_hat, ColumnScaling<double>(A), 1e-12);
+    CHECK(info.converged);
+    CHECK((x_hat-x).cwiseAbs().maxCoeff() == doctest::Approx(0).epsilon(0.0001));
+}
+
+TEST_CASE("Iterative positive definite") {
+    
+    const int n = 50;
+    Eigen::MatrixXd A = Eigen::MatrixXd::Zero(n, n);
+    for(int i=0; i<n; ++i){
+        A(i,i) = 2+i;
+        if(i>0) A(i,i-1) = A(i-1,i) = -1;
+    }
+    Eigen::VectorXd x = Eigen::VectorXd::LinSpaced(n, -1, 1);
+    Eigen::VectorXd b = A*x;
+    
+    if(print) std::cout << "Iterative dense" << std::endl;
+    check_iterative(A, b, x);
+    
+    if(print) std::cout << "Iterative sparse" << std::endl;
+    Eigen::SparseMatrix<double> A_sparse = A.sparseView();
+    check_iterative(A_sparse, b, x);
+}
+
+TEST_CASE("Iterative indefinite and least squares") {
+    
+    Eigen::MatrixXd A(3,3);
+    Eigen::VectorXd b(3);
+    Eigen::VectorXd x(3);
+    A << 1,2,0,  2,-3,1,  0,1,4;
+    x << -2, 1, 1;
+    b = A*x;
+    
+    Eigen::VectorXd x_hat;
+    auto info = solvelin::iterative::minres(A, b, x_hat);
+    CHECK(info.converged);
+    CHECK((x_hat-x).cwiseAbs().maxCoeff() == doctest::Approx(0).epsilon(0.0001));
+
+    // the initial residual b is a direction of negative curvature
+    Eigen::VectorXd e(3);
+    e << 0, 1, 0;
+    x_hat.resize(0);
+    info = solvelin::iterative::cg(A, e, x_hat);
+    CHECK(info.breakdown);
+    CHECK_FALSE(info.converged);
+    CHECK(x_hat.allFinite());
+    CHECK(info.iterations == 0);
+    
+    Eigen::MatrixXd C = Eigen::MatrixXd::Random(30, 4);
+    Eigen::VectorXd d = Eigen::VectorXd::Random(30);
+    Eigen::VectorXd y = solvelin::qr::colPivHouseholderQr(C, d);
+    
+    x_hat.resize(0);
+    info = solvelin::iterative::lsqr(C, d, x_hat, solvelin::iterative::Identity<double>(), 1e-12);
+    CHECK(info.converged);
+    CHECK((x_hat-y).cwiseAbs().maxCoeff() == doctest::Approx(0).epsilon(0.0001));
+    
+    CHECK_THROWS(solvelin::iterative::cg(C, d, x_hat));
+}
+
+TEST_CASE("Reusable factorization") {
+
+    Eigen::MatrixXd A(3,3);
+    Eigen::VectorXd x(3);
+    A << 2,-1,0,  -1,2,-1,  0,-1,2;
+    x << 4.75, 6.5, 5.25;
+    const Eigen::MatrixXd A0 = A;
+
+    CHECK(solvelin::is_symmetric(A));
+
+    solvelin::cholesky::LDLT<> ldlt(A, true);
+    CHECK(ldlt.info() == Eigen::Success);
+    CHECK(ldlt.bound_to(A));
+
+    // several right hand sides against the same factors
+    Eigen::MatrixXd B(3,2);
+    B << A0*x, 2*A0*x;
+    Eigen::MatrixXd X = ldlt.solve(B);
+    CHECK((X.col(0)-x).cwiseAbs().maxCoeff() == doctest::Approx(0).epsilon(0.0001));
+    CHECK((X.col(1)-2*x).cwiseAbs().maxCoeff() == doctest::Approx(0).epsilon(0.0001));
+
+    Eigen::VectorXd x_hat;
+    ldlt.solve(A0*x, x_hat);
+    CHECK((x_hat-x).cwiseAbs().maxCoeff() == doctest::Approx(0).epsilon(0.0001));
+
+    // new values written into the same buffer
+    A = 2*A0;
+    ldlt.refactor();
+    x_hat = ldlt.solve(A0*x);
+    CHECK((x_hat-x/2).cwiseAbs().maxCoeff() == doctest::Approx(0).epsilon(0.0001));
+
+    std::optional<solvelin::cholesky::LDLT<>> reused;
+    A = A0;
+    solvelin::cholesky::LDLT<>::compute(reused, A);
+    CHECK(reused->bound_to(A));
+    // values written in place keep the binding, compute() then refactors instead of binding a new factorization
+    A = 2*A0;
+    CHECK(reused->bound_to(A));
+    solvelin::cholesky::LDLT<>::compute(reused, A);
+    CHECK((reused->solve(A0*x)-x/2).cwiseAbs().maxCoeff() == doctest::Approx(0).epsilon(0.0001));
+    // a matrix move-assigned from a temporary has new storage and needs a new binding
+    Eigen::MatrixXd A_new = Eigen::MatrixXd::Zero(3, 3);
+    solvelin::cholesky::LDLT<>::compute(reused, A_new);
+    A_new = Eigen::MatrixXd(A0);
+    CHECK_FALSE(reused->bound_to(A_new));
+    solvelin::cholesky::LDLT<>::compute(reused, A_new);
+    CHECK(reused->bound_to(A_new));
+    CHECK((reused->solve(A0*x)-x).cwiseAbs().maxCoeff() == doctest::Approx(0).epsilon(0.0001));
+
+    Eigen::MatrixXd C(3,3);
+    C << 1,2,3,  4,5,6,  7,8,10;
+    CHECK_FALSE(solvelin::is_symmetric(C));
+    CHECK_THROWS(solvelin::cholesky::LLT<>(C, true));
+    CHECK_NOTHROW(solvelin::cholesky::LLT<>(C));
+
+    Eigen::MatrixXd C0 = C;
+    solvelin::lu::PartialPiv<> lu(C);
+    x_hat = lu.solve(C0*x);
+    CHECK((x_hat-x).cwiseAbs().maxCoeff() == doctest::Approx(0).epsilon(0.0001));
+    CHECK_FALSE(lu.bound_to(C0));
+}
+
+TEST_CASE("Fallback chain") {
+
+    Eigen::MatrixXd A(3,3);
+    Eigen::VectorXd x(3);
+    A << 2,-1,0,  -1,2,-1,  0,-1,2;
+    x << 4.75, 6.5, 5.25;
+    Eigen::VectorXd b = A*x;
+
+    auto result = solvelin::cholesky::try_ldlt(A, b);
+    CHECK(result);
+    CHECK((result.x-x).cwiseAbs().maxCoeff() == doctest::Approx(0).epsilon(0.0001));
+
+    Eigen::MatrixXd C(3,3);
+    C << 1,2,3,  4,5,6,  7,8,10;
+    CHECK(solvelin::cholesky::try_llt(C, b).status == solvelin::Status::NotSymmetric);
+    CHECK(solvelin::cholesky::try_ldlt(Eigen::MatrixXd(C.leftCols(2)), b).status == solvelin::Status::NotSquare);
+    CHECK(solvelin::cholesky::try_llt(Eigen::MatrixXd(-A), b).status == solvelin::Status::NotPositiveDefinite);
+
+    solvelin::SymmetricSolver<> solver;
+    CHECK(solver.compute(A) == solvelin::Status::Success);
+    CHECK(solver.method() == solvelin::Method::LDLT);
+    CHECK((solver.solve(b).x-x).cwiseAbs().maxCoeff() == doctest::Approx(0).epsilon(0.0001));
+
+    // J^T J of a rank one Jacobian
+    Eigen::MatrixXd J(4,2);
+    J << 1,1,  2,2,  -1,-1,  3,3;
+    Eigen::MatrixXd JtJ = J.transpose()*J;
+    Eigen::VectorXd Jtr = J.transpose()*Eigen::VectorXd::Ones(4);
+    CHECK(solver.compute(JtJ) == solvelin::Status::Success);
+    CHECK(solver.method() == solvelin::Method::Regularized);
+    CHECK(solver.shift() > 0);
+    result = solver.solve(Jtr);
+    CHECK(result);
+    CHECK((JtJ*result.x-Jtr).norm() == doctest::Approx(0).epsilon(1e-6));
+
+    solvelin::FallbackOptions options;
+    options.regularize = false;
+    solvelin::SymmetricSolver<> cod(options);
+    CHECK(cod.compute(JtJ) == solvelin::Status::Success);
+    CHECK(cod.method() == solvelin::Method::COD);
+    result = cod.solve(Jtr);
+    CHECK(result.x(0) == doctest::Approx(result.x(1)));
+    CHECK((JtJ*result.x-Jtr).norm() == doctest::Approx(0).epsilon(1e-9));
+
+    options.cod = false;
+    solvelin::SymmetricSolver<> none(options);
+    CHECK(none.compute(JtJ) == solvelin::Status::NotPositiveDefinite);
+    CHECK_FALSE(none.solve(Jtr));
+}
+
+TEST_CASE("Mixed precision") {
+
+    const int n = 100;
+    Eigen::MatrixXd A = Eigen::MatrixXd::Zero(n, n);
+    for(int i=0; i<n; ++i){
+        A(i,i) = 4+i%7;
+        if(i>0) A(i,i-1) = A(i-1,i) = -1;
+    }
+    Eigen::VectorXd x = Eigen::VectorXd::LinSpaced(n, -1, 1);
+    Eigen::VectorXd b = A*x;
+
+    solvelin::MixedPrecisionSolver<> solver;
+    CHECK(solver.compute(A) == solvelin::Status::Success);
+    auto result = solver.solve(b);
+    CHECK(result);
+    CHECK(solver.refinements() > 0);
+    CHECK_FALSE(solver.full_precision());
+    // accuracy of the double solve although the factors are single precision
+    CHECK((result.x-x).cwiseAbs().maxCoeff() < 1e-12);
+    if(print) std::cout << "mixed precision refinements " << solver.refinements() << std::endl;
+
+    // condition number ~1e9, out of reach of single precision refinement
+    Eigen::MatrixXd Q = Eigen::MatrixXd::Random(n, n).householderQr().householderQ();
+    Eigen::MatrixXd B = Q*(std::log(10.0)*Eigen::VectorXd::LinSpaced(n, -9, 0)).array().exp().matrix().asDiagonal()*Q.transpose();
+    B = (B+B.transpose())/2;
+    b = B*x;
+    CHECK(solver.compute(B) == solvelin::Status::Success);
+    result = solver.solve(b);
+    CHECK(result);
+    CHECK(solver.full_precision());
+    CHECK((result.x-x).cwiseAbs().maxCoeff() < 1e-5);
+
+    Eigen::MatrixXd C = -A;
+    CHECK(solver.compute(C) == solvelin::Status::NotPositiveDefinite);
+    CHECK_FALSE(solver.solve(b));
+}
+
+TEST_CASE("Randomized least squares") {
+
+    const int m = 2000;
+    const int n = 20;
+    Eigen::MatrixXd A = Eigen::MatrixXd::Random(m, n);
+    // columns scaled over six orders of magnitude
+    for(int j=0; j<n; ++j)
+        A.col(j) *= std::pow(10.0, 6.0*j/(n-1));
+    Eigen::VectorXd b = Eigen::VectorXd::Random(m);
+    Eigen::VectorXd y = solvelin::qr::colPivHouseholderQr(A, b);
+
+    Eigen::SparseMatrix<double> S = solvelin::randomized::sparse_sign(80, m);
+    CHECK(S.rows() == 80);
+    CHECK(S.cols() == m);
+    CHECK(S.nonZeros() == 8*m);
+
+    Eigen::VectorXd x_hat;
+    auto info = solvelin::randomized::lstsq(A, b, x_hat);
+    CHECK(info.converged);
+    CHECK(info.iterations < 60);
+    CHECK(((x_hat-y).array()/y.array().abs().max(1e-300)).abs().maxCoeff() < 1e-6);
+    CHECK((A.transpose()*(A*x_hat-b)).norm() <= 1e-8*(A.transpose()*b).norm());
+    if(print) std::cout << "randomized lsqr iterations " << info.iterations << std::endl;
+
+    // unpreconditioned lsqr stalls on the same system
+    x_hat.resize(0);
+    info = solvelin::iterative::lsqr(A, b, x_hat, solvelin::iterative::Identity<double>(), 1e-12, 60);
+    CHECK_FALSE(info.converged);
+
+    Eigen::SparseMatrix<double> A_sparse = (A.array().abs()>5e-1*A.cwiseAbs().colwise().maxCoeff().replicate(m, 1).array()).select(A, 0).sparseView();
+    Eigen::VectorXd y_sparse = solvelin::qr::colPivHouseholderQr(Eigen::MatrixXd(A_sparse), b);
+    x_hat.resize(0);
+    info = solvelin::randomized::lstsq(A_sparse, b, x_hat);
+    CHECK(info.converged);
+    CHECK(((x_hat-y_sparse).array()/y_sparse.array().abs().max(1e-300)).abs().maxCoeff() < 1e-6);
+}
+
+TEST_CASE("Least squares selection") {
+
+    Eigen::MatrixXd square = Eigen::MatrixXd::Random(30, 30);
+    Eigen::MatrixXd tall = Eigen::MatrixXd::Random(2000, 30);
+    Eigen::MatrixXd medium = Eigen::MatrixXd::Random(300, 30);
+    // nearly collinear columns of equal norms, A^T A would square the condition number
+    Eigen::MatrixXd ill = medium;
+    ill.col(1) = ill.col(0) + 1e-7*Eigen::VectorXd::Random(300);
+    // independent columns of very different scales are well conditioned once the columns are equilibrated
+    Eigen::MatrixXd scaled = medium;
+    scaled.col(0) *= 1e-7;
+    Eigen::MatrixXd banded = Eigen::MatrixXd::Zero(2000, 30);
+    for(int i=0; i<2000; ++i)
+        banded.row(i).segment(i%29, 2) = Eigen::RowVector2d::Random();
+
+    CHECK(solvelin::select(square) == solvelin::LeastSquares::HouseholderQR);
+    CHECK(solvelin::select(tall) == solvelin::LeastSquares::Sketch);
+    CHECK(solvelin::select(medium) == solvelin::LeastSquares::NormalEquations);
+    CHECK(solvelin::select(ill) == solvelin::LeastSquares::ColPivQR);
+    CHECK(solvelin::select(scaled) == solvelin::LeastSquares::NormalEquations);
+    // two nonzeros per row, forming A^T A is cheaper than lsqr iterations
+    CHECK(solvelin::select(banded) == solvelin::LeastSquares::NormalEquations);
+    CHECK(solvelin::condition_estimate(ill) > 1e6);
+    CHECK(solvelin::condition_estimate(scaled) < 10);
+    CHECK(solvelin::condition_estimate(scaled) == doctest::Approx(solvelin::condition_estimate(medium)));
+
+    // within a small factor of the condition number of the equilibrated matrix from its singular values
+    for(const Eigen::MatrixXd& A:{square, tall, ill}){
+        const Eigen::MatrixXd equilibrated = A*A.colwise().norm().cwiseInverse().asDiagonal();
+        const Eigen::VectorXd sigma = equilibrated.jacobiSvd().singularValues();
+        const double condition = sigma(0)/sigma(sigma.size()-1);
+        CHECK(solvelin::condition_estimate(A) > condition/10);
+        CHECK(solvelin::condition_estimate(A) < condition*10);
+    }
+
+    for(const Eigen::MatrixXd& A:{square, tall, medium, ill, scaled, banded}){
+        Eigen::VectorXd b = Eigen::VectorXd::Random(A.rows());
+        Eigen::VectorXd y = solvelin::qr::colPivHouseholderQr(A, b);
+        solvelin::LeastSquaresSolver<> solver;
+        solver.compute(A);
+        auto result = solver.solve(b);
+        CHECK(result);
+        CHECK(solver.method() == solver.selected());
+        CHECK(((result.x-y).array()/y.array().abs().max(1e-300)).abs().maxCoeff() < 1e-6);
+    }
+
+    // identical columns, the normal equations forced on them fall back to rank revealing QR
+    Eigen::MatrixXd rank_deficient = medium;
+    rank_deficient.col(1) = rank_deficient.col(0);
+    CHECK(solvelin::select(rank_deficient) == solvelin::LeastSquares::ColPivQR);
+    solvelin::LeastSquaresSolver<> solver;
+    CHECK(solver.compute(rank_deficient, solvelin::LeastSquares::NormalEquations) == solvelin::LeastSquares::ColPivQR);
+    CHECK(solver.selected() == solvelin::LeastSquares::NormalEquations);
+    Eigen::VectorXd b = rank_deficient*Eigen::VectorXd::Ones(30);
+    CHECK(solver.solve(b));
+    CHECK((rank_deficient*solver.solve(b).x-b).norm() < 1e-10*b.norm());
+
+    auto tuning = solvelin::calibrate({{40, 20}, {4000, 20}}, 1);
+    REQUIRE(tuning.fastest.size() == 2);
+    CHECK(tuning.fastest[0].rows == 40);
+    CHECK(tuning.fastest[0].method != solvelin::LeastSquares::Sketch);
+    if(print) 
+        for(const auto& e:tuning.fastest) 
+            std::cout << "fastest (" << e.rows << "," << e.cols << ") " << solvelin::to_string(e.method) << std::endl;
+
+    const std::string path = temp_path("test_tuning.txt");
+    tuning.max_condition = 1e4;
+    tuning.save(path);
+    auto loaded = solvelin::Tuning::load(path);
+    CHECK(loaded.max_condition == tuning.max_condition);
+    REQUIRE(loaded.fastest.size() == 2);
+    for(int i=0; i<2; ++i){
+        CHECK(loaded.fastest[i].rows == tuning.fastest[i].rows);
+        CHECK(loaded.fastest[i].cols == tuning.fastest[i].cols);
+        CHECK(loaded.fastest[i].method == tuning.fastest[i].method);
+    }
+    CHECK(solvelin::select(Eigen::MatrixXd::Random(50, 20), loaded) == tuning.fastest[0].method);
+    CHECK(solvelin::load_or_calibrate(path).fastest.size() == 2);
+
+    std::ofstream(path) << "fastest 10 10 Cholesky\n";
+    CHECK_THROWS(solvelin::Tuning::load(path));
+    std::filesystem::remove(path);
+    CHECK_THROWS(solvelin::Tuning::load(path));
+}
+
 TEST_CASE("Version") {
     static_assert(std::string_view(NON_LIN_OPTIM_VERSION) == std::string_view("1.0"));
     CHECK(std::string(NON_LIN_OPTIM_VERSION) == std::string("1.0"));
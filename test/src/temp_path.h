@@ -0,0 +1,12 @@
+#pragma once
+
+#include <filesystem>
+#include <random>
+#include <string>
+
+// Path in the temporary directory unique to this run, so concurrent test runs do not share files
+inline
+std::string temp_path(const std::string& name){
+    static const std::string run = std::to_string(std::random_device()());
+    return (std::filesystem::temp_directory_path() / ("non_lin_optim_" + run + "_" + name)).string();
+}
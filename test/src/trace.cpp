@@ -0,0 +1,92 @@
+#include <doctest/doctest.h>
+
+#include <non_lin_optim/trace.h>
+#include <non_lin_optim/optim.h>
+#include <non_lin_optim/version.h>
+
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace non_lin_optim;
+
+static int occurrences(const std::string& s, const std::string& pattern){
+    int n = 0;
+    for(size_t pos=s.find(pattern); pos!=std::string::npos; pos=s.find(pattern, pos+1))
+        ++n;
+    return n;
+}
+
+static std::string exported(){
+    std::ostringstream out;
+    trace::write_chrome_json(out);
+    return out.str();
+}
+
+TEST_CASE("Trace per-thread buffers and Chrome export") {
+
+    trace::clear();
+    {
+        trace::Scope scope("test", "ignored");
+    }
+    CHECK(occurrences(exported(), "\"ignored\"") == 0);
+
+    trace::start();
+    const int threads = 4;
+    const int events = 5000;
+    std::vector<std::thread> workers;
+    for(int t=0; t<threads; ++t){
+        workers.emplace_back([t]{
+            trace::name_thread("test \"" + std::to_string(t) + "\"");
+            for(int i=0; i<events; ++i)
+                trace::Scope scope("test", "work", "i", i);
+        });
+    }
+    // exporting while the threads record sees a consistent prefix of every buffer
+    const std::string partial = exported();
+    for(auto& worker:workers)
+        worker.join();
+    trace::stop();
+
+    CHECK(occurrences(partial, "\"work\"") <= threads*events);
+    const std::string json = exported();
+    CHECK(json.rfind("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", 0) == 0);
+    CHECK(occurrences(json, "\"name\":\"work\",\"cat\":\"test\",\"ph\":\"X\"") == threads*events);
+    CHECK(occurrences(json, "\"args\":{\"i\":4999}") == threads);
+    CHECK(occurrences(json, "\"args\":{\"name\":\"test \\\"3\\\"\"}") == 1);
+
+    trace::clear();
+    CHECK(occurrences(exported(), "\"work\"") == 0);
+}
+
+TEST_CASE("Trace points of the optimizers") {
+
+    auto func = [](const Vector& x) -> Vector {
+        Vector r(2);
+        r(0) = 10*(x(1)-x(0)*x(0));
+        r(1) = 1-x(0);
+        return r;
+    };
+
+    trace::clear();
+    trace::start();
+    Vector x(2);
+    x << -1.2, 1.0;
+    optim::GaussianNewton(func, 100, 1e-20).run(x);
+    trace::stop();
+    const std::string json = exported();
+    trace::clear();
+
+#if NON_LIN_OPTIM_TRACE
+    CHECK(occurrences(json, "\"name\":\"run\"") == 1);
+    CHECK(occurrences(json, "\"name\":\"iteration\"") > 1);
+    CHECK(occurrences(json, "\"name\":\"jacobian column\"") > 1);
+    CHECK(occurrences(json, "\"name\":\"SymmetricSolver::compute\"") > 1);
+#else
+    CHECK(occurrences(json, "\"ph\":\"X\"") == 0);
+    int evaluated = 0;
+    NON_LIN_OPTIM_TRACE_SCOPE_ARG("test", "disabled", "n", ++evaluated);
+    CHECK(evaluated == 0);
+#endif
+}